@@ -298,6 +298,15 @@ int main()
 		return false;
 	}
 
+	// resolve uniform locations once, the render loop only uses the cached values
+	GLint loc_offsetx = glGetUniformLocation(shader_programme, "offsetx");
+	GLint loc_offsety = glGetUniformLocation(shader_programme, "offsety");
+	GLint loc_tx = glGetUniformLocation(shader_programme, "tx");
+	GLint loc_ty = glGetUniformLocation(shader_programme, "ty");
+	GLint loc_layer_z = glGetUniformLocation(shader_programme, "layer_z");
+	GLint loc_weight = glGetUniformLocation(shader_programme, "weight");
+	GLint loc_sprite = glGetUniformLocation(shader_programme, "sprite");
+
 	float previous = glfwGetTime();
     
     
@@ -327,6 +336,10 @@ int main()
 		glUseProgram(shader_programme);
 
 		glBindVertexArray(VAO);
+		// state shared by all tiles of the layer
+		glBindTexture(GL_TEXTURE_2D, tmap->getTileSet());
+		glUniform1i(loc_sprite, 0);
+		glUniform1f(loc_layer_z, tmap->getZ());
         float x, y;
         int r = 0, c = 0;
         for(int r = 0; r < tmap->getHeight(); r++) {
@@ -337,17 +350,12 @@ int main()
                                 
                 tview->computeDrawPosition(c, r, tw, th, x, y);
                 
-                glUniform1f(glGetUniformLocation(shader_programme, "offsetx"), u * tileW);
-                glUniform1f(glGetUniformLocation(shader_programme, "offsety"), v * tileH);
-                glUniform1f(glGetUniformLocation(shader_programme, "tx"), x);
-                glUniform1f(glGetUniformLocation(shader_programme, "ty"), y + 1.0);
-                glUniform1f(glGetUniformLocation(shader_programme, "layer_z"), tmap->getZ());                
-                glUniform1f(glGetUniformLocation(shader_programme, "weight"), (c == cx) && (r == cy) ? 0.5 : 0.0);                
+                glUniform1f(loc_offsetx, u * tileW);
+                glUniform1f(loc_offsety, v * tileH);
+                glUniform1f(loc_tx, x);
+                glUniform1f(loc_ty, y + 1.0);
+                glUniform1f(loc_weight, (c == cx) && (r == cy) ? 0.5 : 0.0);
                 
-                // bind Texture
-                // glActiveTexture(GL_TEXTURE0);
-                glBindTexture(GL_TEXTURE_2D, tmap->getTileSet());
-                glUniform1i(glGetUniformLocation(shader_programme, "sprite"), 0);
                 glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
             }
             
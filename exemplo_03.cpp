@@ -1,70 +1,820 @@
 #include <iostream>
 #include <string>
+#include <vector>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <future>
+#include <tuple>
+#include <utility>
 #include <stdio.h>
 #include <stdlib.h>
-#include <fstream>
-#include <sstream>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
 #include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 using namespace std;
 
-unsigned char *open(string file, int &width, int &height) {
-    ifstream arq(file);
-    char BUFFER[1024];
-    arq.getline(BUFFER, 1024);
-    char type = BUFFER[1];
-    cout << BUFFER << endl;
-    do {
-        arq.getline(BUFFER, 1024);
-        cout << "." << BUFFER << "." << endl;
-    } while (BUFFER[0] == '#');
-    stringstream sstr(BUFFER);
-    int w;
-    int h;
-    sstr >> w;
-    sstr >> h;
-    width = w;
-    height = h;
+// Imagem PNM (P2/P3/P5/P6) com os pixels intercalados, linha a linha.
+// Arquivos binários ficam mapeados em memória (MAP_PRIVATE): data aponta
+// direto para os pixels do arquivo e os filtros escrevem nele sem copiar
+// e sem alterar o arquivo original.
+struct Image {
+    int width = 0;
+    int height = 0;
+    int channels = 0;              // 1 (PGM) ou 3 (PPM)
+    unsigned char *data = nullptr;
+    void *mapping = nullptr;       // mmap do arquivo, ou nullptr se data veio de new[]
+    size_t mappingSize = 0;
+};
+
+// Lê o próximo inteiro, pulando espaços e comentários (#...).
+static inline bool readInt(const unsigned char *&p, const unsigned char *end, int &value) {
+    while (p < end) {
+        if (*p == '#') {
+            while (p < end && *p != '\n') p++;
+        } else if (*p == ' ' || (*p >= '\t' && *p <= '\r')) {
+            p++;
+        } else {
+            break;
+        }
+    }
+    if (p == end || (unsigned)(*p - '0') > 9) return false;
+    value = 0;
+    while (p < end && (unsigned)(*p - '0') <= 9) {
+        value = value * 10 + (*p++ - '0');
+        if (value > (1 << 24)) return false;
+    }
+    return true;
+}
+
+struct ImageHeader {
+    char type;             // '2', '3', '5' ou '6'
+    int width;
+    int height;
     int maxValue;
-    arq >> maxValue;
-    cout << w << " X " << h << " mv: " << maxValue << endl; 
-    unsigned char *data = new unsigned char [w * h * 3];
-    if (type == '3') {
+    size_t dataOffset;     // primeiro byte dos pixels
+};
+
+// Lê o cabeçalho PNM de [begin, end). Imagens de 16 bits (maxValue > 255)
+// não são suportadas.
+static bool parseHeader(const unsigned char *begin, const unsigned char *end, ImageHeader &header) {
+    if (end - begin < 2 || begin[0] != 'P' || !strchr("2356", begin[1])) return false;
+    const unsigned char *p = begin + 2;
+    header.type = begin[1];
+    if (!readInt(p, end, header.width) || !readInt(p, end, header.height) ||
+        !readInt(p, end, header.maxValue) || header.width <= 0 || header.height <= 0 ||
+        header.maxValue <= 0 || header.maxValue > 255) {
+        return false;
+    }
+    if (header.type == '5' || header.type == '6') {
+        // modo binário: um único espaço separa o cabeçalho dos pixels
+        if (p == end || !isspace(*p)) return false;
+        p++;
+    }
+    header.dataOffset = p - begin;
+    return true;
+}
+
+static int formatHeader(char *buffer, size_t size, char type, int w, int h) {
+    return snprintf(buffer, size, "P%c\n#Gerado por chroma-key.\n%d %d\n255\n", type, w, h);
+}
+
+// Leva as amostras de 0..maxValue para 0..255; valores acima de maxValue
+// são saturados.
+static void rescale(unsigned char *data, size_t length, int maxValue) {
+    if (maxValue == 255) return;
+    for (size_t i = 0; i < length; i++) {
+        data[i] = (unsigned char)(min<int>(data[i], maxValue) * 255 / maxValue);
+    }
+}
+
+void closeImage(Image &img) {
+    if (img.mapping) {
+        munmap(img.mapping, img.mappingSize);
+    } else {
+        delete [] img.data;
+    }
+    img = Image();
+}
+
+bool openImage(const string &file, Image &img) {
+    int fd = ::open(file.c_str(), O_RDONLY);
+    if (fd < 0) {
+        cerr << "Erro ao abrir " << file << ": " << strerror(errno) << endl;
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < 2) {
+        cerr << "Arquivo vazio ou inválido: " << file << endl;
+        ::close(fd);
+        return false;
+    }
+    size_t size = st.st_size;
+    void *mapping = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (mapping == MAP_FAILED) {
+        cerr << "Erro ao mapear " << file << ": " << strerror(errno) << endl;
+        return false;
+    }
+    madvise(mapping, size, MADV_SEQUENTIAL);
+
+    const unsigned char *begin = (const unsigned char *)mapping;
+    const unsigned char *end = begin + size;
+    ImageHeader header;
+    if (!parseHeader(begin, end, header)) {
+        cerr << "Cabeçalho PNM inválido: " << file << endl;
+        munmap(mapping, size);
+        return false;
+    }
+    char type = header.type;
+    int w = header.width;
+    int h = header.height;
+    int maxValue = header.maxValue;
+    const unsigned char *p = begin + header.dataOffset;
+    cout << "P" << type << " " << w << " X " << h << " mv: " << maxValue << endl;
+
+    int channels = (type == '3' || type == '6') ? 3 : 1;
+    size_t length = (size_t)w * h * channels;
+    unsigned char *data;
+    if (type == '5' || type == '6') {
+        // modo binário
+        if ((size_t)(end - p) < length) {
+            cerr << "Arquivo truncado: " << file << endl;
+            munmap(mapping, size);
+            return false;
+        }
+        data = (unsigned char *)mapping + (p - begin);
+        img.mapping = mapping;
+        img.mappingSize = size;
+    } else {
         // modo texto
-        int j=0;
-        while (!arq.eof()) {
-            int g;
-            arq >> g;
-            data[j++] = (unsigned char)g;
+        data = new unsigned char [length];
+        for (size_t i = 0; i < length; i++) {
+            int v;
+            if (!readInt(p, end, v)) {
+                cerr << "Arquivo truncado: " << file << endl;
+                delete [] data;
+                munmap(mapping, size);
+                return false;
+            }
+            data[i] = (unsigned char)(v < maxValue ? v : maxValue);
         }
-    } else { 
-        // modo binário
-        arq.read(reinterpret_cast<char*> (&data), sizeof(data));
+        munmap(mapping, size);
+    }
+    rescale(data, length, maxValue);
+    img.width = w;
+    img.height = h;
+    img.channels = channels;
+    img.data = data;
+    return true;
+}
+
+// Os filtros trabalham em RGB: expande uma imagem em tons de cinza.
+void toRGB(Image &img) {
+    if (img.channels == 3) return;
+    size_t pixels = (size_t)img.width * img.height;
+    unsigned char *data = new unsigned char [pixels * 3];
+    for (size_t i = 0; i < pixels; i++) {
+        data[i*3] = data[i*3+1] = data[i*3+2] = img.data[i];
+    }
+    Image rgb;
+    rgb.width = img.width;
+    rgb.height = img.height;
+    rgb.channels = 3;
+    rgb.data = data;
+    closeImage(img);
+    img = rgb;
+}
+
+// Salva em binário (P5/P6) com uma única escrita dos pixels, ou em texto
+// (P2/P3) montando as linhas num buffer que é escrito em blocos.
+bool saveImage(const string &file, const Image &img, bool text = false) {
+    FILE *arq = fopen(file.c_str(), "wb");
+    if (!arq) {
+        cerr << "Erro ao criar " << file << ": " << strerror(errno) << endl;
+        return false;
+    }
+    char type = (img.channels == 3) ? (text ? '3' : '6') : (text ? '2' : '5');
+    char header[64];
+    fwrite(header, 1, formatHeader(header, sizeof(header), type, img.width, img.height), arq);
+
+    size_t length = (size_t)img.width * img.height * img.channels;
+    bool ok = true;
+    if (!text) {
+        ok = fwrite(img.data, 1, length, arq) == length;
+    } else {
+        char digits[256][4];
+        int digitsLen[256];
+        for (int v = 0; v < 256; v++) {
+            digitsLen[v] = snprintf(digits[v], 4, "%d", v);
+        }
+        const size_t bufferSize = 1 << 20;
+        char *buffer = new char [bufferSize];
+        size_t n = 0;
+        for (size_t i = 0; i < length && ok; i += img.channels) {
+            for (int c = 0; c < img.channels; c++) {
+                unsigned char v = img.data[i + c];
+                memcpy(buffer + n, digits[v], 4);
+                n += digitsLen[v];
+                buffer[n++] = (c + 1 < img.channels) ? ' ' : '\n';
+            }
+            if (n > bufferSize - 64) {
+                ok = fwrite(buffer, 1, n, arq) == n;
+                n = 0;
+            }
+        }
+        ok = ok && fwrite(buffer, 1, n, arq) == n;
+        delete [] buffer;
+    }
+    if (fclose(arq) != 0) ok = false;
+    if (!ok) {
+        cerr << "Erro ao escrever " << file << endl;
+    }
+    return ok;
+}
+
+// Kernels dos filtros sobre `pixels` pixels RGB intercalados. A versão
+// escalar é a referência; as versões SIMD devem produzir os mesmos bytes.
+struct FilterKernels {
+    const char *name;
+    // zera os pixels com distância² até a cor-chave menor que limit
+    void (*chromaKey)(unsigned char *data, size_t pixels, const unsigned char key[3], int limit);
+    // cinza = soma ponderada com pesos em ponto fixo Q15
+    void (*grayScale)(unsigned char *data, size_t pixels, const int weights[3]);
+    void (*colorize)(unsigned char *data, size_t pixels, const unsigned char color[3]);
+    void (*negative)(unsigned char *data, size_t pixels);
+};
+
+static void chromaKeyScalar(unsigned char *data, size_t pixels, const unsigned char key[3], int limit) {
+    for (size_t i = 0; i < pixels * 3; i += 3) {
+        int dr = data[i] - key[0];
+        int dg = data[i+1] - key[1];
+        int db = data[i+2] - key[2];
+        if (dr*dr + dg*dg + db*db < limit) {
+            data[i] = data[i+1] = data[i+2] = 0;
+        }
+    }
+}
+
+static void grayScaleScalar(unsigned char *data, size_t pixels, const int weights[3]) {
+    for (size_t i = 0; i < pixels * 3; i += 3) {
+        int v = (data[i] * weights[0] + data[i+1] * weights[1] + data[i+2] * weights[2]) >> 15;
+        data[i] = data[i+1] = data[i+2] = (unsigned char)v;
+    }
+}
+
+static void colorizeScalar(unsigned char *data, size_t pixels, const unsigned char color[3]) {
+    for (size_t i = 0; i < pixels * 3; i += 3) {
+        data[i]   |= color[0];
+        data[i+1] |= color[1];
+        data[i+2] |= color[2];
+    }
+}
+
+static void negativeScalar(unsigned char *data, size_t pixels) {
+    for (size_t i = 0; i < pixels * 3; i++) {
+        data[i] ^= 255;
+    }
+}
+
+static const FilterKernels scalarKernels = {
+    "scalar", chromaKeyScalar, grayScaleScalar, colorizeScalar, negativeScalar
+};
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define FILTER_SIMD 1
+
+// As versões SIMD separam os canais de 4 pixels (12 bytes) por vez com
+// pshufb. Cada iteração carrega 48 bytes (16 pixels) em três registros,
+// que split4 reparte em 4 grupos de 12 bytes e join4 remonta. Com AVX2 as
+// duas metades de 128 bits tratam 48 bytes cada.
+#define RG_SHUFFLE 0,-1,1,-1, 3,-1,4,-1, 6,-1,7,-1, 9,-1,10,-1
+#define B_SHUFFLE  2,-1,-1,-1, 5,-1,-1,-1, 8,-1,-1,-1, 11,-1,-1,-1
+#define SPREAD_SHUFFLE 0,0,0, 4,4,4, 8,8,8, 12,12,12, -1,-1,-1,-1
+
+__attribute__((target("ssse3")))
+static inline void split4(__m128i v0, __m128i v1, __m128i v2, __m128i g[4]) {
+    g[0] = v0;
+    g[1] = _mm_alignr_epi8(v1, v0, 12);
+    g[2] = _mm_alignr_epi8(v2, v1, 8);
+    g[3] = _mm_srli_si128(v2, 4);
+}
+
+// Os bytes 12..15 de cada grupo devem ser zero.
+__attribute__((target("ssse3")))
+static inline void join4(const __m128i g[4], __m128i v[3]) {
+    v[0] = _mm_or_si128(g[0], _mm_slli_si128(g[1], 12));
+    v[1] = _mm_or_si128(_mm_srli_si128(g[1], 4), _mm_slli_si128(g[2], 8));
+    v[2] = _mm_or_si128(_mm_srli_si128(g[2], 8), _mm_slli_si128(g[3], 4));
+}
+
+__attribute__((target("ssse3")))
+static void chromaKeySsse3(unsigned char *data, size_t pixels, const unsigned char key[3], int limit) {
+    const __m128i rgShuffle = _mm_setr_epi8(RG_SHUFFLE);
+    const __m128i bShuffle = _mm_setr_epi8(B_SHUFFLE);
+    const __m128i spread = _mm_setr_epi8(SPREAD_SHUFFLE);
+    const __m128i keyRG = _mm_set1_epi32(key[0] | (key[1] << 16));
+    const __m128i keyB = _mm_set1_epi32(key[2]);
+    const __m128i lim = _mm_set1_epi32(limit);
+    size_t i = 0;
+    for (; i + 16 <= pixels; i += 16) {
+        __m128i *p = (__m128i *)(data + i*3);
+        __m128i v[3] = { _mm_loadu_si128(p), _mm_loadu_si128(p + 1), _mm_loadu_si128(p + 2) };
+        __m128i g[4], hit[3];
+        split4(v[0], v[1], v[2], g);
+        for (int k = 0; k < 4; k++) {
+            __m128i rg = _mm_sub_epi16(_mm_shuffle_epi8(g[k], rgShuffle), keyRG);
+            __m128i b = _mm_sub_epi16(_mm_shuffle_epi8(g[k], bShuffle), keyB);
+            __m128i d2 = _mm_add_epi32(_mm_madd_epi16(rg, rg), _mm_madd_epi16(b, b));
+            g[k] = _mm_shuffle_epi8(_mm_cmplt_epi32(d2, lim), spread);
+        }
+        join4(g, hit);
+        for (int k = 0; k < 3; k++) {
+            _mm_storeu_si128(p + k, _mm_andnot_si128(hit[k], v[k]));
+        }
+    }
+    chromaKeyScalar(data + i*3, pixels - i, key, limit);
+}
+
+__attribute__((target("ssse3")))
+static void grayScaleSsse3(unsigned char *data, size_t pixels, const int weights[3]) {
+    const __m128i rgShuffle = _mm_setr_epi8(RG_SHUFFLE);
+    const __m128i bShuffle = _mm_setr_epi8(B_SHUFFLE);
+    const __m128i spread = _mm_setr_epi8(SPREAD_SHUFFLE);
+    const __m128i wRG = _mm_set1_epi32(weights[0] | (weights[1] << 16));
+    const __m128i wB = _mm_set1_epi32(weights[2]);
+    size_t i = 0;
+    for (; i + 16 <= pixels; i += 16) {
+        __m128i *p = (__m128i *)(data + i*3);
+        __m128i v[3], g[4];
+        split4(_mm_loadu_si128(p), _mm_loadu_si128(p + 1), _mm_loadu_si128(p + 2), g);
+        for (int k = 0; k < 4; k++) {
+            __m128i sum = _mm_add_epi32(_mm_madd_epi16(_mm_shuffle_epi8(g[k], rgShuffle), wRG),
+                                        _mm_madd_epi16(_mm_shuffle_epi8(g[k], bShuffle), wB));
+            g[k] = _mm_shuffle_epi8(_mm_srli_epi32(sum, 15), spread);
+        }
+        join4(g, v);
+        for (int k = 0; k < 3; k++) {
+            _mm_storeu_si128(p + k, v[k]);
+        }
+    }
+    grayScaleScalar(data + i*3, pixels - i, weights);
+}
+
+static void colorizeSse2(unsigned char *data, size_t pixels, const unsigned char color[3]) {
+    // 48 bytes = 16 pixels por iteração, três registros com o padrão RGB
+    unsigned char pattern[48];
+    for (int k = 0; k < 48; k++) pattern[k] = color[k % 3];
+    __m128i c[3];
+    for (int k = 0; k < 3; k++) c[k] = _mm_loadu_si128((const __m128i *)pattern + k);
+    size_t i = 0;
+    for (; i + 16 <= pixels; i += 16) {
+        __m128i *p = (__m128i *)(data + i*3);
+        for (int k = 0; k < 3; k++) {
+            _mm_storeu_si128(p + k, _mm_or_si128(_mm_loadu_si128(p + k), c[k]));
+        }
+    }
+    colorizeScalar(data + i*3, pixels - i, color);
+}
+
+static void negativeSse2(unsigned char *data, size_t pixels) {
+    const __m128i ones = _mm_set1_epi8(-1);
+    size_t length = pixels * 3;
+    size_t i = 0;
+    for (; i + 16 <= length; i += 16) {
+        __m128i *p = (__m128i *)(data + i);
+        _mm_storeu_si128(p, _mm_xor_si128(_mm_loadu_si128(p), ones));
+    }
+    for (; i < length; i++) {
+        data[i] ^= 255;
+    }
+}
+
+// Metade baixa com os bytes p..p+47, metade alta com p+48..p+95.
+__attribute__((target("avx2")))
+static inline void load96(const unsigned char *p, __m256i v[3]) {
+    const __m128i *q = (const __m128i *)p;
+    for (int k = 0; k < 3; k++) {
+        v[k] = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128(q + k)),
+                                       _mm_loadu_si128(q + 3 + k), 1);
+    }
+}
+
+__attribute__((target("avx2")))
+static inline void store96(unsigned char *p, const __m256i v[3]) {
+    __m128i *q = (__m128i *)p;
+    for (int k = 0; k < 3; k++) {
+        _mm_storeu_si128(q + k, _mm256_castsi256_si128(v[k]));
+        _mm_storeu_si128(q + 3 + k, _mm256_extracti128_si256(v[k], 1));
+    }
+}
+
+__attribute__((target("avx2")))
+static inline void split4(const __m256i v[3], __m256i g[4]) {
+    g[0] = v[0];
+    g[1] = _mm256_alignr_epi8(v[1], v[0], 12);
+    g[2] = _mm256_alignr_epi8(v[2], v[1], 8);
+    g[3] = _mm256_bsrli_epi128(v[2], 4);
+}
+
+__attribute__((target("avx2")))
+static inline void join4(const __m256i g[4], __m256i v[3]) {
+    v[0] = _mm256_or_si256(g[0], _mm256_bslli_epi128(g[1], 12));
+    v[1] = _mm256_or_si256(_mm256_bsrli_epi128(g[1], 4), _mm256_bslli_epi128(g[2], 8));
+    v[2] = _mm256_or_si256(_mm256_bsrli_epi128(g[2], 8), _mm256_bslli_epi128(g[3], 4));
+}
+
+__attribute__((target("avx2")))
+static void chromaKeyAvx2(unsigned char *data, size_t pixels, const unsigned char key[3], int limit) {
+    const __m256i rgShuffle = _mm256_setr_epi8(RG_SHUFFLE, RG_SHUFFLE);
+    const __m256i bShuffle = _mm256_setr_epi8(B_SHUFFLE, B_SHUFFLE);
+    const __m256i spread = _mm256_setr_epi8(SPREAD_SHUFFLE, SPREAD_SHUFFLE);
+    const __m256i keyRG = _mm256_set1_epi32(key[0] | (key[1] << 16));
+    const __m256i keyB = _mm256_set1_epi32(key[2]);
+    const __m256i lim = _mm256_set1_epi32(limit);
+    size_t i = 0;
+    for (; i + 32 <= pixels; i += 32) {
+        unsigned char *p = data + i*3;
+        __m256i v[3], g[4], hit[3];
+        load96(p, v);
+        split4(v, g);
+        for (int k = 0; k < 4; k++) {
+            __m256i rg = _mm256_sub_epi16(_mm256_shuffle_epi8(g[k], rgShuffle), keyRG);
+            __m256i b = _mm256_sub_epi16(_mm256_shuffle_epi8(g[k], bShuffle), keyB);
+            __m256i d2 = _mm256_add_epi32(_mm256_madd_epi16(rg, rg), _mm256_madd_epi16(b, b));
+            g[k] = _mm256_shuffle_epi8(_mm256_cmpgt_epi32(lim, d2), spread);
+        }
+        join4(g, hit);
+        for (int k = 0; k < 3; k++) {
+            v[k] = _mm256_andnot_si256(hit[k], v[k]);
+        }
+        store96(p, v);
+    }
+    chromaKeySsse3(data + i*3, pixels - i, key, limit);
+}
+
+__attribute__((target("avx2")))
+static void grayScaleAvx2(unsigned char *data, size_t pixels, const int weights[3]) {
+    const __m256i rgShuffle = _mm256_setr_epi8(RG_SHUFFLE, RG_SHUFFLE);
+    const __m256i bShuffle = _mm256_setr_epi8(B_SHUFFLE, B_SHUFFLE);
+    const __m256i spread = _mm256_setr_epi8(SPREAD_SHUFFLE, SPREAD_SHUFFLE);
+    const __m256i wRG = _mm256_set1_epi32(weights[0] | (weights[1] << 16));
+    const __m256i wB = _mm256_set1_epi32(weights[2]);
+    size_t i = 0;
+    for (; i + 32 <= pixels; i += 32) {
+        unsigned char *p = data + i*3;
+        __m256i v[3], g[4];
+        load96(p, v);
+        split4(v, g);
+        for (int k = 0; k < 4; k++) {
+            __m256i sum = _mm256_add_epi32(_mm256_madd_epi16(_mm256_shuffle_epi8(g[k], rgShuffle), wRG),
+                                           _mm256_madd_epi16(_mm256_shuffle_epi8(g[k], bShuffle), wB));
+            g[k] = _mm256_shuffle_epi8(_mm256_srli_epi32(sum, 15), spread);
+        }
+        join4(g, v);
+        store96(p, v);
+    }
+    grayScaleSsse3(data + i*3, pixels - i, weights);
+}
+
+__attribute__((target("avx2")))
+static void colorizeAvx2(unsigned char *data, size_t pixels, const unsigned char color[3]) {
+    // 96 bytes = 32 pixels por iteração, três registros com o padrão RGB
+    unsigned char pattern[96];
+    for (int k = 0; k < 96; k++) pattern[k] = color[k % 3];
+    __m256i c[3];
+    for (int k = 0; k < 3; k++) c[k] = _mm256_loadu_si256((const __m256i *)pattern + k);
+    size_t i = 0;
+    for (; i + 32 <= pixels; i += 32) {
+        __m256i *p = (__m256i *)(data + i*3);
+        for (int k = 0; k < 3; k++) {
+            _mm256_storeu_si256(p + k, _mm256_or_si256(_mm256_loadu_si256(p + k), c[k]));
+        }
+    }
+    colorizeSse2(data + i*3, pixels - i, color);
+}
+
+__attribute__((target("avx2")))
+static void negativeAvx2(unsigned char *data, size_t pixels) {
+    const __m256i ones = _mm256_set1_epi8(-1);
+    size_t length = pixels * 3;
+    size_t i = 0;
+    for (; i + 32 <= length; i += 32) {
+        __m256i *p = (__m256i *)(data + i);
+        _mm256_storeu_si256(p, _mm256_xor_si256(_mm256_loadu_si256(p), ones));
+    }
+    for (; i < length; i++) {
+        data[i] ^= 255;
+    }
+}
+
+static const FilterKernels ssse3Kernels = {
+    "ssse3", chromaKeySsse3, grayScaleSsse3, colorizeSse2, negativeSse2
+};
+
+static const FilterKernels avx2Kernels = {
+    "avx2", chromaKeyAvx2, grayScaleAvx2, colorizeAvx2, negativeAvx2
+};
+#endif
+
+// Escolhe os kernels pela CPU na primeira chamada. FILTER_KERNELS=scalar
+// (ou ssse3/avx2) força uma versão, para comparar com a referência.
+const FilterKernels &filterKernels() {
+    static const FilterKernels *chosen = [] {
+        const char *force = getenv("FILTER_KERNELS");
+        if (force && strcmp(force, "scalar") == 0) {
+            return &scalarKernels;
+        }
+#ifdef FILTER_SIMD
+        bool noAvx2 = force && strcmp(force, "ssse3") == 0;
+        if (!noAvx2 && __builtin_cpu_supports("avx2")) {
+            return &avx2Kernels;
+        }
+        if (__builtin_cpu_supports("ssse3")) {
+            return &ssse3Kernels;
+        }
+#endif
+        return &scalarKernels;
+    }();
+    return *chosen;
+}
+
+// Pool persistente de threads que aplica um kernel por pixel em faixas de
+// linhas. Cada faixa tem ~256 KiB para caber na cache L2; as threads (e a
+// que chamou run) pegam a próxima faixa de um contador atômico.
+struct FilterExecutor {
+    typedef function<void(unsigned char *data, size_t pixels)> Kernel;
+
+    static const size_t kBandBytes = 256 * 1024;
+
+    vector<thread> workers;
+    mutex lock;
+    condition_variable wake;
+    condition_variable done;
+    unsigned generation = 0;
+    unsigned busy = 0;
+    bool quit = false;
+
+    // trabalho atual
+    const Kernel *kernel = nullptr;
+    unsigned char *data = nullptr;
+    size_t rowPixels = 0;
+    int rows = 0;
+    int bandRows = 1;
+    int bands = 0;
+    atomic<int> nextBand;
+
+    explicit FilterExecutor(unsigned threads) : nextBand(0) {
+        for (unsigned i = 1; i < threads; i++) {
+            workers.emplace_back([this] { workerMain(); });
+        }
+    }
+
+    ~FilterExecutor() {
+        {
+            lock_guard<mutex> guard(lock);
+            quit = true;
+        }
+        wake.notify_all();
+        for (thread &t : workers) t.join();
+    }
+
+    unsigned threads() const { return workers.size() + 1; }
+
+    void run(unsigned char *image, int w, int h, const Kernel &k) {
+        if (w <= 0 || h <= 0) return;
+        {
+            lock_guard<mutex> guard(lock);
+            kernel = &k;
+            data = image;
+            rowPixels = w;
+            rows = h;
+            bandRows = (int)max<size_t>(1, kBandBytes / (rowPixels * 3));
+            bands = (rows + bandRows - 1) / bandRows;
+            nextBand = 0;
+            busy = workers.size();
+            generation++;
+        }
+        wake.notify_all();
+        work();
+        unique_lock<mutex> guard(lock);
+        done.wait(guard, [this] { return busy == 0; });
+    }
+
+private:
+    void work() {
+        for (int b = nextBand++; b < bands; b = nextBand++) {
+            int first = b * bandRows;
+            int count = min(bandRows, rows - first);
+            (*kernel)(data + first * rowPixels * 3, count * rowPixels);
+        }
+    }
+
+    void workerMain() {
+        unsigned seen = 0;
+        unique_lock<mutex> guard(lock);
+        for (;;) {
+            wake.wait(guard, [&] { return quit || generation != seen; });
+            if (quit) return;
+            seen = generation;
+            guard.unlock();
+            work();
+            guard.lock();
+            if (--busy == 0) done.notify_one();
+        }
+    }
+};
+
+// Executor compartilhado pelos filtros. FILTER_THREADS define o número de
+// threads (padrão: um por núcleo).
+FilterExecutor &filterExecutor() {
+    static FilterExecutor executor([] {
+        const char *env = getenv("FILTER_THREADS");
+        int n = env ? atoi(env) : (int)thread::hardware_concurrency();
+        return (unsigned)max(n, 1);
+    }());
+    return executor;
+}
+
+// Filtros pontuais: block() aplica o filtro em um trecho contíguo de
+// pixels com os kernels de filterKernels().
+struct ChromaKey {
+    unsigned char key[3];
+    int limit;     // distância² máxima (exclusiva) até a cor-chave
+
+    ChromaKey(unsigned char r, unsigned char g, unsigned char b, int limit)
+        : key{ r, g, b }, limit(limit) {}
+
+    void block(unsigned char *data, size_t pixels) const {
+        filterKernels().chromaKey(data, pixels, key, limit);
+    }
+};
+
+// Pesos em ponto fixo Q15 (1.0 = 32768).
+struct GrayScale {
+    int weights[3];
+
+    GrayScale(int wr, int wg, int wb) : weights{ wr, wg, wb } {}
+
+    void block(unsigned char *data, size_t pixels) const {
+        filterKernels().grayScale(data, pixels, weights);
+    }
+};
+
+struct Colorize {
+    unsigned char color[3];
+
+    Colorize(unsigned char r, unsigned char g, unsigned char b) : color{ r, g, b } {}
+
+    void block(unsigned char *data, size_t pixels) const {
+        filterKernels().colorize(data, pixels, color);
     }
-    arq.close();
-    return data;
+};
+
+struct Negative {
+    void block(unsigned char *data, size_t pixels) const {
+        filterKernels().negative(data, pixels);
+    }
+};
+
+// Encadeia filtros pontuais em um único kernel, montado em tempo de
+// compilação. Os pixels são percorridos em blocos que cabem na cache L1 e
+// cada bloco passa por todos os filtros antes do próximo: N filtros custam
+// uma passada pela memória e cada filtro ainda usa seu kernel SIMD.
+template<class... Filters>
+struct FilterPipeline {
+    static constexpr size_t kBlockPixels = 8192;     // 24 KiB
+
+    tuple<Filters...> filters;
+
+    void operator()(unsigned char *data, size_t pixels) const {
+        for (size_t i = 0; i < pixels; i += kBlockPixels) {
+            apply(data + i*3, min(kBlockPixels, pixels - i), index_sequence_for<Filters...>());
+        }
+    }
+
+private:
+    template<size_t... I>
+    void apply(unsigned char *data, size_t pixels, index_sequence<I...>) const {
+        (get<I>(filters).block(data, pixels), ...);
+    }
+};
+
+template<class... Filters>
+FilterPipeline<Filters...> makePipeline(Filters... filters) {
+    return FilterPipeline<Filters...>{ make_tuple(filters...) };
 }
 
-void save(string file, unsigned char *data, int &w, int &h) {
-    ofstream arq(file);
-    arq << "P3" << endl;
-    arq << "#Gerado por chroma-key." << endl;
-    arq << w << " " << h << endl << "255" << endl;
-    int length = w * h * 3;
-    for (int i = 0; i < length; i++) {
-        arq << (int)data[i] << endl;
-    }    
-    arq.close();
+static bool readAll(int fd, unsigned char *p, size_t n, off_t offset) {
+    while (n > 0) {
+        ssize_t r = pread(fd, p, n, offset);
+        if (r < 0 && errno == EINTR) continue;
+        if (r <= 0) return false;
+        p += r;
+        n -= r;
+        offset += r;
+    }
+    return true;
 }
 
-double dist(int &r1, int &g1, int &b1, int &r2, int &g2, int &b2) {
-    double r = r1 - r2;
-    double g = g1 - g2;
-    double b = b1 - b2;
-    return sqrt(r*r + g*g + b*b);
+static bool writeAll(int fd, const unsigned char *p, size_t n) {
+    while (n > 0) {
+        ssize_t r = write(fd, p, n);
+        if (r < 0 && errno == EINTR) continue;
+        if (r <= 0) return false;
+        p += r;
+        n -= r;
+    }
+    return true;
 }
 
-void chromaKey(unsigned char *data, int w, int h) {
+// Aplica o kernel numa imagem binária (P5/P6) sem carregá-la inteira: a
+// imagem é lida em faixas de ~bandBytes e, enquanto uma faixa é filtrada,
+// outra thread grava a faixa anterior e lê a próxima no segundo buffer. A
+// memória usada são dois buffers, independente do tamanho da imagem. A
+// saída é sempre P6.
+bool streamImage(const string &inFile, const string &outFile,
+                 const FilterExecutor::Kernel &kernel, size_t bandBytes = 64 << 20) {
+    int in = ::open(inFile.c_str(), O_RDONLY);
+    if (in < 0) {
+        cerr << "Erro ao abrir " << inFile << ": " << strerror(errno) << endl;
+        return false;
+    }
+    posix_fadvise(in, 0, 0, POSIX_FADV_SEQUENTIAL);
+    unsigned char head[4096];
+    ssize_t headSize = pread(in, head, sizeof(head), 0);
+    ImageHeader header;
+    if (headSize <= 0 || !parseHeader(head, head + headSize, header) ||
+        (header.type != '5' && header.type != '6')) {
+        cerr << "Cabeçalho PNM binário inválido: " << inFile << endl;
+        ::close(in);
+        return false;
+    }
+    int out = ::open(outFile.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (out < 0) {
+        cerr << "Erro ao criar " << outFile << ": " << strerror(errno) << endl;
+        ::close(in);
+        return false;
+    }
+    int w = header.width;
+    int h = header.height;
+    cout << "P" << header.type << " " << w << " X " << h << " mv: " << header.maxValue << " (em faixas)" << endl;
+
+    int channels = (header.type == '6') ? 3 : 1;
+    size_t rowIn = (size_t)w * channels;
+    int bandRows = (int)min<size_t>(h, max<size_t>(1, bandBytes / ((size_t)w * 3)));
+    int bands = (h + bandRows - 1) / bandRows;
+    vector<unsigned char> buffers[2];
+    buffers[0].resize((size_t)bandRows * w * 3);
+    buffers[1].resize((size_t)bandRows * w * 3);
+
+    auto bandHeight = [&](int band) { return min(bandRows, h - band * bandRows); };
+    auto readBand = [&](int band, unsigned char *data) {
+        size_t pixels = (size_t)bandHeight(band) * w;
+        off_t offset = header.dataOffset + (off_t)band * bandRows * rowIn;
+        if (!readAll(in, data, pixels * channels, offset)) return false;
+        rescale(data, pixels * channels, header.maxValue);
+        if (channels == 1) {
+            // expande de trás para frente, no próprio buffer
+            for (size_t i = pixels; i-- > 0;) {
+                data[i*3] = data[i*3+1] = data[i*3+2] = data[i];
+            }
+        }
+        return true;
+    };
+
+    char text[64];
+    int textSize = formatHeader(text, sizeof(text), '6', w, h);
+    bool ok = writeAll(out, (const unsigned char *)text, textSize) && readBand(0, buffers[0].data());
+    for (int b = 0; ok && b < bands; b++) {
+        unsigned char *current = buffers[b % 2].data();
+        unsigned char *other = buffers[(b + 1) % 2].data();
+        future<bool> io = async(launch::async, [&, b, other] {
+            if (b > 0 && !writeAll(out, other, (size_t)bandHeight(b - 1) * w * 3)) return false;
+            return b + 1 == bands || readBand(b + 1, other);
+        });
+        filterExecutor().run(current, w, bandHeight(b), kernel);
+        ok = io.get();
+    }
+    ok = ok && writeAll(out, buffers[(bands - 1) % 2].data(), (size_t)bandHeight(bands - 1) * w * 3);
+    ::close(in);
+    if (::close(out) != 0) ok = false;
+    if (!ok) {
+        cerr << "Erro ao processar " << inFile << " em faixas (arquivo truncado ou disco cheio?)" << endl;
+    }
+    return ok;
+}
+
+ChromaKey askChromaKey() {
     int r, g, b;
     cout << "Cor-chave: " << endl;
     cout << "\tR: ";
@@ -77,48 +827,22 @@ void chromaKey(unsigned char *data, int w, int h) {
     cout << "% Tolerência (0..1): ";
     double t;
     cin >> t;
-    
-
-    double dmax = 441.6729559301;
 
-    int length = w * h * 3;
-    for (int i = 0; i < length; i += 3) {
-        int ri = data[i] & 0xff;
-        int gi = data[i+1] & 0xff;
-        int bi = data[i+2] & 0xff;
-        double d = dist(r, g, b, ri, gi, bi);
-        if (d/dmax < t) {
-            data[i] = 0;
-            data[i+1] = 0;
-            data[i+2] = 0;
-        }
-    }
+    // d/dmax < t  <=>  d² < t² * dmax², com dmax² = 3 * 255²
+    double limit = (t > 0) ? ceil(t * t * 195075.0) : 0;
+    return ChromaKey(r, g, b, (int)fmin(limit, 195076.0));
 }
 
-void grayScale(unsigned char *data, int w, int h) {
+GrayScale askGrayScale() {
     cout << "Média aritmética (S) ou ponderada? ";
     char op;
     cin >> op;
-    double rw, gw, bw;
-    if ((op == 'S') || (op == 's')) {
-        rw = gw = bw = 1.0/3.0;
-    } else {
-        rw = 0.2125; 
-        gw = 0.7154;
-        bw = 0.0721;
-    }
-
-    int length = w * h * 3;
-    for (int i = 0; i < length; i += 3) {
-        int ri = data[i] & 0xff;
-        int gi = data[i+1] & 0xff;
-        int bi = data[i+2] & 0xff;
-
-        data[i] = data[i+1] = data[i+2] = (int)(ri * rw + gi * gw + bi * bw);
-    }
+    if ((op == 'S') || (op == 's'))
+        return GrayScale(10923, 10923, 10923);  // 1/3
+    return GrayScale(6963, 23442, 2363);        // 0.2125, 0.7154, 0.0721
 }
 
-void colorize(unsigned char *data, int w, int h) {
+Colorize askColorize() {
     int r, g, b;
     cout << "Cor de base: " << endl;
     cout << "\tR: ";
@@ -127,58 +851,67 @@ void colorize(unsigned char *data, int w, int h) {
     cin >> g;
     cout << "\tB: ";
     cin >> b;
-    
-    int length = w * h * 3;
-    for (int i = 0; i < length; i += 3) {
-        int ri = data[i] & 0xff;
-        int gi = data[i+1] & 0xff;
-        int bi = data[i+2] & 0xff;
-
-        data[i]   = ri | r;
-        data[i+1] = gi | g;
-        data[i+2] = bi | b;
-    }
+    return Colorize(r, g, b);
 }
 
-void negative(unsigned char *data, int w, int h) {
-    int length = w * h * 3;
-    for (int i = 0; i < length; i += 3) {
-        int ri = data[i] & 0xff;
-        int gi = data[i+1] & 0xff;
-        int bi = data[i+2] & 0xff;
+// Pergunta o filtro e seus parâmetros; retorna um kernel vazio se a opção
+// for inválida.
+FilterExecutor::Kernel askFilter() {
+    int opt;
+    cout << "Qual opção de filtro você quer aplicar (1-chroma-key, 2-gray-scale, 3-colorize, 4-negative, "
+            "5-gray-scale + chroma-key + colorize)? ";
+    cin >> opt;
 
-        data[i]   = ri ^ 255;
-        data[i+1] = gi ^ 255;
-        data[i+2] = bi ^ 255;
+    switch(opt) {
+        case 1:  return makePipeline(askChromaKey());
+        case 2:  return makePipeline(askGrayScale());
+        case 3:  return makePipeline(askColorize());
+        case 4:  return makePipeline(Negative());
+        case 5: {
+            // gray-scale, chroma-key e colorize em uma única passada
+            GrayScale gray = askGrayScale();
+            ChromaKey key = askChromaKey();
+            Colorize color = askColorize();
+            return makePipeline(gray, key, color);
+        }
+        default: cout << "Opção inválida!!";
     }
+    return nullptr;
 }
 
+// Imagens binárias maiores que isso são processadas em faixas, com saída P6.
+static const size_t kStreamBytes = (size_t)1 << 30;
+
 int main() {
     string file;
     cout << "Digite caminho para o arquivo da imagem de entrada: ";
     getline(cin, file);
 
-    int w, h;
-    unsigned char *data = open(file, w, h);
-    // cout << ((int)data[0]) << "..." << ((int)data[w * h * 3 - 1]) << endl;
-
-
-    int opt;
-    cout << "Qual opção de filtro você quer aplicar (1-chroma-key, 2-gray-scale, 3-colorize, 4-negative)? ";
-    cin >> opt;
+    FilterExecutor::Kernel kernel = askFilter();
+    if (!kernel) {
+        return EXIT_FAILURE;
+    }
 
-    switch(opt) {
-        case 1:  chromaKey(data, w, h); break;
-        case 2:  grayScale(data, w, h); break;
-        case 3:  colorize(data, w, h);  break;
-        case 4:  negative(data, w, h);  break;
-        default: cout << "Opção inválida!!";
+    // imagens binárias muito grandes não cabem na memória
+    ImageHeader header;
+    unsigned char head[4096];
+    int fd = ::open(file.c_str(), O_RDONLY);
+    ssize_t headSize = (fd >= 0) ? pread(fd, head, sizeof(head), 0) : -1;
+    if (fd >= 0) ::close(fd);
+    if (headSize > 0 && parseHeader(head, head + headSize, header) &&
+        (header.type == '5' || header.type == '6') &&
+        (size_t)header.width * header.height * 3 > kStreamBytes) {
+        return streamImage(file, "output.ppm", kernel) ? EXIT_SUCCESS : EXIT_FAILURE;
     }
 
-    if ((opt > 0) && (opt < 5)){
-        save("output.ppm", data, w, h);
+    Image img;
+    if (!openImage(file, img)) {
+        return EXIT_FAILURE;
     }
-    
-    delete [] data;
-    return EXIT_SUCCESS;
+    toRGB(img);
+    filterExecutor().run(img.data, img.width, img.height, kernel);
+    // mantém a saída em P3, como o programa original
+    bool ok = saveImage("output.ppm", img, true);
+    closeImage(img);
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
 }
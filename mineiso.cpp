@@ -9,9 +9,24 @@
 #include <optional>
 #include <algorithm>
 #include <memory>
+#include <map>
 #include <functional>
 #include <unordered_map>
 #include <thread>
+#include <limits>
+#include <chrono>
+#include <mutex>
+#include <cstdint>
+#include <utility>
+#include <cctype>
+#include <atomic>
+#include <cstring>
+#include <unordered_set>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include <GL/glew.h>
 #include <GLFW/glfw3.h>
@@ -34,22 +49,205 @@ using namespace std::chrono_literals;
 /// Settings
 
 constexpr size_t WIDTH = 1280, HEIGHT = 720;
+/// Simulation rate, every game_update advances the game by one fixed tick
+constexpr float kTickRate = 120.f;
+constexpr float kTickDuration = 1.f / kTickRate;
+/// Longest frame time simulated at once, longer hitches slow the game down instead
+constexpr float kMaxFrameTime = 0.25f;
+/// Headless mode runs the simulation without a window nor a GL context,
+/// GL resources are then host-side placeholders with zero ids
+static bool g_headless = false;
+/// Size of the map in cells, set with --map-size
+static glm::uvec3 g_map_size = {20, 20, 10};
+/// Seed of the generated terrain, set with --seed, a new random one for every map otherwise
+static std::optional<uint64_t> g_world_seed;
+/// Threads used to generate terrain, set with --threads
+static unsigned g_num_threads = std::max(1u, std::thread::hardware_concurrency());
+/// World file loaded at start if it exists, and saved to with F6, set with --world
+static std::string g_world_path;
+/// Distance below the lowest row of the map at which falling objects stop
+constexpr float kSettleDepth = 50.f;
+/// File the profile trace is written to, on F8 and at exit
+constexpr const char* kProfileTracePath = "profile-trace.json";
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+/// Profiler
+
+/// Timing of one completed scope
+struct ProfileEvent {
+    const char* name;  // must outlive the profiler, usually a string literal
+    int64_t begin_us;  // microseconds since the profiler started
+    int64_t duration_us;
+};
+
+/// Number of latest events kept per thread
+constexpr size_t kProfileRingSize = 1 << 16;
+
+/// Ring buffer of the latest events recorded by one thread, only written by its owner thread
+struct ProfileRing {
+    uint32_t tid;
+    size_t count = 0;  // number of events ever pushed
+    std::vector<ProfileEvent> events = std::vector<ProfileEvent>(kProfileRingSize);
+
+    void push(const ProfileEvent& event) { events[count++ % kProfileRingSize] = event; }
+};
+
+/// Registry of the ring buffers of all threads
+struct Profiler {
+    std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+    std::mutex mutex;
+    std::vector<std::unique_ptr<ProfileRing>> rings;
+
+    static Profiler& instance() { static Profiler profiler; return profiler; }
+
+    int64_t now_us() const {
+        return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - epoch).count();
+    }
+
+    /// Get the ring buffer of the calling thread, registering it on first use
+    ProfileRing& thread_ring() {
+        thread_local ProfileRing* ring = nullptr;
+        if (!ring) {
+            std::lock_guard lock(mutex);
+            rings.push_back(std::make_unique<ProfileRing>());
+            ring = rings.back().get();
+            ring->tid = rings.size();
+        }
+        return *ring;
+    }
+
+    /// Write all recorded events in Chrome trace format, to be opened in chrome://tracing or Perfetto.
+    /// Call it while no other thread is recording.
+    bool dump(const std::string& filepath) {
+        FILE* file = fopen(filepath.data(), "w");
+        if (!file) {
+            fprintf(stderr, "Failed to write profile trace (%s)\n", filepath.data());
+            return false;
+        }
+        std::lock_guard lock(mutex);
+        fprintf(file, "{\"traceEvents\":[");
+        bool first = true;
+        for (auto& ring : rings) {
+            size_t begin = ring->count > kProfileRingSize ? ring->count - kProfileRingSize : 0;
+            for (size_t i = begin; i < ring->count; i++) {
+                const ProfileEvent& event = ring->events[i % kProfileRingSize];
+                fprintf(file, "%s\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%lld,\"dur\":%lld}",
+                        first ? "" : ",", event.name, ring->tid, (long long)event.begin_us, (long long)event.duration_us);
+                first = false;
+            }
+        }
+        fprintf(file, "\n]}\n");
+        fclose(file);
+        printf("Profile trace written to %s\n", filepath.data());
+        return true;
+    }
+};
+
+/// Records the time spent in the enclosing scope into the profiler
+struct ScopeTimer {
+    const char* name;
+    int64_t begin_us;
+
+    explicit ScopeTimer(const char* name) : name(name), begin_us(Profiler::instance().now_us()) {}
+    ~ScopeTimer() {
+        Profiler& profiler = Profiler::instance();
+        profiler.thread_ring().push({ name, begin_us, profiler.now_us() - begin_us });
+    }
+    ScopeTimer(const ScopeTimer&) = delete;
+    ScopeTimer& operator=(const ScopeTimer&) = delete;
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+/// Parallel
+
+/// Run fn(n) for every n in [0, count) on up to num_threads threads, the calling thread included.
+/// Indices are handed out one at a time, so each should be a sizable amount of work.
+template<typename F>
+void parallel_for(size_t count, unsigned num_threads, F&& fn)
+{
+    std::atomic<size_t> next{0};
+    auto worker = [&] {
+        for (size_t n; (n = next++) < count;)
+            fn(n);
+    };
+    std::vector<std::thread> threads;
+    for (size_t t = 1; t < std::min<size_t>(num_threads, count); t++)
+        threads.emplace_back(worker);
+    worker();
+    for (std::thread& thread : threads)
+        thread.join();
+}
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 /// Shader
 
+/// Uniform block binding point of the Camera block, shared by all shader programs
+constexpr GLuint kCameraUniformBinding = 0;
+
+/// Shader program with its uniform locations resolved at link time
+struct ShaderProgram {
+    GLuint id;
+    GLint model;
+    GLint color;
+};
+
+/// Compile and link a shader program from source, binding its Camera block if present
+GLuint build_shader_program(const char* vertex_shader, const char* fragment_shader)
+{
+    GLint status;
+    GLchar info_log[512];
+
+    GLuint vs = glCreateShader(GL_VERTEX_SHADER);
+    glShaderSource(vs, 1, &vertex_shader, NULL);
+    glCompileShader(vs);
+    glGetShaderiv(vs, GL_COMPILE_STATUS, &status);
+    if (!status) {
+        glGetShaderInfoLog(vs, sizeof(info_log), NULL, info_log);
+        fprintf(stderr, "Failed to compile vertex shader: %s\n", info_log);
+    }
+
+    GLuint fs = glCreateShader(GL_FRAGMENT_SHADER);
+    glShaderSource(fs, 1, &fragment_shader, NULL);
+    glCompileShader(fs);
+    glGetShaderiv(fs, GL_COMPILE_STATUS, &status);
+    if (!status) {
+        glGetShaderInfoLog(fs, sizeof(info_log), NULL, info_log);
+        fprintf(stderr, "Failed to compile fragment shader: %s\n", info_log);
+    }
+
+    GLuint sp = glCreateProgram();
+    glAttachShader(sp, fs);
+    glAttachShader(sp, vs);
+    glLinkProgram(sp);
+    glGetProgramiv(sp, GL_LINK_STATUS, &status);
+    if (!status) {
+        glGetProgramInfoLog(sp, sizeof(info_log), NULL, info_log);
+        fprintf(stderr, "Failed to link shader program: %s\n", info_log);
+    }
+    glDeleteShader(vs);
+    glDeleteShader(fs);
+
+    GLuint camera_block = glGetUniformBlockIndex(sp, "Camera");
+    if (camera_block != GL_INVALID_INDEX)
+        glUniformBlockBinding(sp, camera_block, kCameraUniformBinding);
+    return sp;
+}
+
 /// Compile and link shader program
-GLuint load_shader_program()
+ShaderProgram load_shader_program()
 {
     const char* vertex_shader = R"(
 #version 410
 layout ( location = 0 ) in vec2 vPosition;
 layout ( location = 1 ) in vec2 vTexCoord;
-uniform mat4 projection;
+layout ( std140 ) uniform Camera {
+    mat4 view;
+    mat4 projection;
+};
 uniform mat4 model;
 out vec2 texcoord;
 void main() {
-    gl_Position = projection * model * vec4(vPosition, 0.0f, 1.0f);
+    gl_Position = projection * view * model * vec4(vPosition, 0.0f, 1.0f);
     texcoord = vTexCoord;
 }
 )";
@@ -65,20 +263,13 @@ void main(){
 }
 )";
 
-    GLuint vs = glCreateShader(GL_VERTEX_SHADER);
-    glShaderSource(vs, 1, &vertex_shader, NULL);
-    glCompileShader(vs);
-
-    GLuint fs = glCreateShader(GL_FRAGMENT_SHADER);
-    glShaderSource(fs, 1, &fragment_shader, NULL);
-    glCompileShader(fs);
-
-    GLuint sp = glCreateProgram();
-    glAttachShader(sp, fs);
-    glAttachShader(sp, vs);
-    glLinkProgram(sp);
-    return sp;
-    }
+    GLuint sp = build_shader_program(vertex_shader, fragment_shader);
+    return ShaderProgram{
+        .id = sp,
+        .model = glGetUniformLocation(sp, "model"),
+        .color = glGetUniformLocation(sp, "color"),
+    };
+}
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 /// GLObject
@@ -104,6 +295,9 @@ using GLObjectRef = std::shared_ptr<GLObject>;
 /// Create an Object in GPU memory
 GLObject create_gl_object(const Vertex vertices[], const size_t num_vertices, const GLushort indices[], const size_t num_indices, GLenum usage = GL_STATIC_DRAW)
 {
+    if (g_headless) {
+        return {0, 0, 0, num_vertices, num_indices};
+    }
     GLuint vao, vbo, ebo;
     glGenVertexArrays(1, &vao);
     glGenBuffers(1, &vbo);
@@ -121,6 +315,19 @@ GLObject create_gl_object(const Vertex vertices[], const size_t num_vertices, co
     return {vao, vbo, ebo, num_vertices, num_indices};
 }
 
+/// Share ownership of a GLObject, freeing its GPU buffers with the last reference
+GLObjectRef make_gl_object_ref(GLObject glo)
+{
+    return GLObjectRef(new GLObject(std::move(glo)), [](GLObject* glo) {
+        if (!g_headless) {
+            glDeleteVertexArrays(1, &glo->vao);
+            glDeleteBuffers(1, &glo->vbo);
+            glDeleteBuffers(1, &glo->ebo);
+        }
+        delete glo;
+    });
+}
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 /// Geometry
 
@@ -198,6 +405,42 @@ struct SpriteAnimation {
     SpriteFrame& curr_frame() { return frames[curr_frame_idx]; }
 };
 
+///////////////////////////////////////////////////////////////////////////////////////////////////
+/// Geometry Cache
+
+/// Registry of quad meshes in GPU memory, shared by all objects with identical geometry.
+/// Entries are weak, a mesh is freed once no object uses it anymore.
+struct GeometryCache {
+    /// Sprite frame count (0 for a single quad), extent, texture offset, texture size and usage
+    using Key = std::tuple<size_t, float, float, float, float, float, float, GLenum>;
+    std::map<Key, std::weak_ptr<GLObject>> objects;
+
+    /// Get the QUAD from gen_quad_geometry with the given parameters, uploading it on first use
+    GLObjectRef quad(glm::vec2 v, glm::vec2 to, glm::vec2 ts, GLenum usage = GL_STATIC_DRAW) {
+        std::weak_ptr<GLObject>& entry = objects[{0, v.x, v.y, to.x, to.y, ts.x, ts.y, usage}];
+        if (GLObjectRef glo = entry.lock())
+            return glo;
+        auto [vertices, indices] = gen_quad_geometry(v, to, ts);
+        GLObjectRef glo = make_gl_object_ref(create_gl_object(vertices.data(), vertices.size(), indices.data(), indices.size(), usage));
+        entry = glo;
+        return glo;
+    }
+
+    /// Get the QUADs from gen_sprite_quads with the given parameters, uploading them on first use
+    GLObjectRef sprite_quads(size_t count, glm::vec2 v, glm::vec2 to, glm::vec2 ts, GLenum usage = GL_STATIC_DRAW) {
+        std::weak_ptr<GLObject>& entry = objects[{count, v.x, v.y, to.x, to.y, ts.x, ts.y, usage}];
+        if (GLObjectRef glo = entry.lock())
+            return glo;
+        auto [vertices, indices] = gen_sprite_quads(count, v, to, ts);
+        GLObjectRef glo = make_gl_object_ref(create_gl_object(vertices.data(), vertices.size(), indices.data(), indices.size(), usage));
+        entry = glo;
+        return glo;
+    }
+};
+
+/// GeometryCache reference type alias
+using GeometryCacheRef = std::shared_ptr<GeometryCache>;
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 /// Textures
 
@@ -209,6 +452,8 @@ using GLTextureRef = std::shared_ptr<GLTexture>;
 /// Read file and upload RGB/RBGA texture to GPU memory
 auto load_rgba_texture(const std::string& inpath) -> std::optional<GLTexture>
 {
+    ScopeTimer timer("load_rgba_texture");
+    if (g_headless) return GLTexture(0);
     const std::string filepath = ASSETS_PATH + "/"s + inpath;
     int width, height, channels;
     stbi_set_flip_vertically_on_load(true);
@@ -231,6 +476,149 @@ auto load_rgba_texture(const std::string& inpath) -> std::optional<GLTexture>
     return texture;
 }
 
+/// Registry of textures in GPU memory keyed by asset path.
+/// Each image is decoded once while referenced, its texture is deleted when the last reference goes away.
+struct TextureCache {
+    std::unordered_map<std::string, std::weak_ptr<GLTexture>> textures;
+
+    /// Get the texture of the given asset path, loading it if not alive yet
+    GLTextureRef load(const std::string& inpath) {
+        std::weak_ptr<GLTexture>& entry = textures[inpath];
+        if (GLTextureRef texture = entry.lock())
+            return texture;
+        auto texture = load_rgba_texture(inpath);
+        if (!texture)
+            return nullptr;
+        GLTextureRef ref(new GLTexture(*texture), [](GLTexture* texture) {
+            if (!g_headless) glDeleteTextures(1, texture);
+            delete texture;
+        });
+        entry = ref;
+        return ref;
+    }
+};
+
+/// TextureCache reference type alias
+using TextureCacheRef = std::shared_ptr<TextureCache>;
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+/// Block Batch
+
+/// Max number of block instances streamed in a single draw call
+constexpr size_t kBlockBatchMaxInstances = 65536;
+
+/// Per-instance attributes of a block drawn by the block shader
+struct BlockInstance {
+    glm::vec2 position;   // canvas position of the block quad
+    glm::vec2 texoffset;  // offset of the block tile in the tileset
+    glm::vec4 color;      // tint, for highlighting
+};
+
+/// Compile and link the instanced block shader program, which draws one shared quad per BlockInstance
+ShaderProgram load_block_shader_program()
+{
+    const char* vertex_shader = R"(
+#version 410
+layout ( location = 0 ) in vec2 vPosition;
+layout ( location = 1 ) in vec2 vTexCoord;
+layout ( location = 2 ) in vec2 iPosition;
+layout ( location = 3 ) in vec2 iTexOffset;
+layout ( location = 4 ) in vec4 iColor;
+layout ( std140 ) uniform Camera {
+    mat4 view;
+    mat4 projection;
+};
+out vec2 texcoord;
+out vec4 color;
+void main() {
+    gl_Position = projection * view * vec4(vPosition + iPosition, 0.0f, 1.0f);
+    texcoord = vTexCoord + iTexOffset;
+    color = iColor;
+}
+)";
+
+    const char* fragment_shader = R"(
+#version 410
+in vec2 texcoord;
+in vec4 color;
+uniform sampler2D texture0;
+out vec4 frag_color;
+void main(){
+    frag_color = texture(texture0, texcoord) * color;
+}
+)";
+
+    GLuint sp = build_shader_program(vertex_shader, fragment_shader);
+    return ShaderProgram{ .id = sp, .model = -1, .color = -1 };
+}
+
+/// Accumulates the blocks of a frame in painter's order and draws each run of them with
+/// a single glDrawElementsInstanced of the shared block quad.
+/// Anything else drawn in between must flush the batch first to keep the order.
+struct BlockBatch {
+    GLuint vao;
+    GLuint instance_vbo;
+    GLObjectRef quad;                      // unit quad with the texcoords of one tile at the tileset origin
+    GLTexture texture;                     // tileset of all blocks
+    ShaderProgram shader;                  // instanced block shader
+    GLuint resume_program;                 // program bound again after each draw, used by the entities in between
+    std::vector<BlockInstance> instances;  // instances of the current run
+    size_t num_draws;                      // draw calls issued since last reset, for stats
+
+    /// Create the instance buffer in GPU memory, and a vertex array reading it alongside the quad.
+    /// Each flush leaves resume_program bound, so the render loop never has to query the current program.
+    static BlockBatch create(GLObjectRef quad, GLTexture texture, GLuint resume_program) {
+        GLuint vao, instance_vbo;
+        glGenVertexArrays(1, &vao);
+        glGenBuffers(1, &instance_vbo);
+        glBindVertexArray(vao);
+        glBindBuffer(GL_ARRAY_BUFFER, quad->vbo);
+        glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid *)offsetof(Vertex, pos));
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid *)offsetof(Vertex, texcoord));
+        glEnableVertexAttribArray(1);
+        glBindBuffer(GL_ARRAY_BUFFER, instance_vbo);
+        glBufferData(GL_ARRAY_BUFFER, kBlockBatchMaxInstances * sizeof(BlockInstance), nullptr, GL_STREAM_DRAW);
+        glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(BlockInstance), (GLvoid *)offsetof(BlockInstance, position));
+        glVertexAttribPointer(3, 2, GL_FLOAT, GL_FALSE, sizeof(BlockInstance), (GLvoid *)offsetof(BlockInstance, texoffset));
+        glVertexAttribPointer(4, 4, GL_FLOAT, GL_FALSE, sizeof(BlockInstance), (GLvoid *)offsetof(BlockInstance, color));
+        for (GLuint attrib = 2; attrib <= 4; attrib++) {
+            glEnableVertexAttribArray(attrib);
+            glVertexAttribDivisor(attrib, 1);
+        }
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, quad->ebo);
+        glBindVertexArray(0);
+        BlockBatch batch{ .vao = vao, .instance_vbo = instance_vbo, .quad = std::move(quad), .texture = texture,
+                          .shader = load_block_shader_program(), .resume_program = resume_program,
+                          .instances = {}, .num_draws = 0 };
+        batch.instances.reserve(kBlockBatchMaxInstances);
+        return batch;
+    }
+
+    void push(const BlockInstance& instance) {
+        if (instances.size() == kBlockBatchMaxInstances)
+            flush();
+        instances.push_back(instance);
+    }
+
+    /// Upload and draw the current run, if any, then bind resume_program again
+    void flush() {
+        if (instances.empty()) return;
+        glUseProgram(shader.id);
+        glBindVertexArray(vao);
+        // orphan the buffer so the driver doesn't stall on draws still in flight
+        glBindBuffer(GL_ARRAY_BUFFER, instance_vbo);
+        glBufferData(GL_ARRAY_BUFFER, kBlockBatchMaxInstances * sizeof(BlockInstance), nullptr, GL_STREAM_DRAW);
+        glBufferSubData(GL_ARRAY_BUFFER, 0, instances.size() * sizeof(BlockInstance), instances.data());
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glDrawElementsInstanced(GL_TRIANGLES, quad->num_indices, GL_UNSIGNED_SHORT, (const void*)0, instances.size());
+        glUseProgram(resume_program);
+        instances.clear();
+        num_draws++;
+    }
+};
+
 //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 /// Window | Viewport | Camera
 
@@ -269,6 +657,30 @@ struct Camera {
             .view = glm::inverse(glm::mat4(1.0f)),
         };
     }
+
+    /// Canvas area in view, as (left, bottom, right, top)
+    glm::vec4 view_rect() const {
+        glm::mat4 inv = glm::inverse(projection * view);
+        glm::vec4 lo = inv * glm::vec4(-1.f, -1.f, 0.f, 1.f);
+        glm::vec4 hi = inv * glm::vec4(+1.f, +1.f, 0.f, 1.f);
+        return { lo.x, lo.y, hi.x, hi.y };
+    }
+};
+
+/// Uniform buffer with the camera matrices, bound to the Camera block of every shader program
+struct CameraUniformBuffer {
+    GLuint ubo;
+
+    /// Create the buffer in GPU memory and bind it to the Camera binding point
+    static CameraUniformBuffer create() {
+        GLuint ubo;
+        glGenBuffers(1, &ubo);
+        glBindBuffer(GL_UNIFORM_BUFFER, ubo);
+        glBufferData(GL_UNIFORM_BUFFER, 2 * sizeof(glm::mat4), nullptr, GL_DYNAMIC_DRAW);
+        glBindBufferBase(GL_UNIFORM_BUFFER, kCameraUniformBinding, ubo);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+        return { ubo };
+    }
 };
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
@@ -292,14 +704,15 @@ struct Transform {
 struct Motion {
     glm::vec2 velocity     {0.0f};
     glm::vec2 acceleration {0.0f};
+    glm::vec2 prev_position{0.0f};  // position before the last tick, for render interpolation
 };
 
 /// Gravity component
 struct Gravity {
 };
 
-/// Highlight component
-struct Highlight {
+/// Tag of entities that change every tick: moving, falling or animated ones
+struct Active {
 };
 
 /// Timed Action
@@ -318,6 +731,349 @@ struct TimedAction {
     }
 };
 
+///////////////////////////////////////////////////////////////////////////////////////////////////
+/// ECS
+
+/// Entity identifier, indexes the sparse arrays of every component storage
+using Entity = uint32_t;
+/// Invalid entity identifier
+constexpr Entity kNullEntity = std::numeric_limits<Entity>::max();
+
+/// Storage of a single component type.
+/// Components are packed contiguously in the dense array, so systems iterate
+/// only over the entities that have the component, in contiguous memory.
+template<typename T>
+struct ComponentArray {
+    std::vector<T> dense;          // packed components
+    std::vector<Entity> entities;  // owner of each packed component
+    std::vector<uint32_t> sparse;  // entity -> index into dense, kNullEntity if none
+
+    size_t size() const { return dense.size(); }
+    bool has(Entity e) const { return e < sparse.size() && sparse[e] != kNullEntity; }
+    /// Get component of entity, nullptr if the entity doesn't have it
+    T* get(Entity e) { return has(e) ? &dense[sparse[e]] : nullptr; }
+    /// Get component of entity, which must have it
+    T& operator[](Entity e) { return dense[sparse[e]]; }
+    const T& operator[](Entity e) const { return dense[sparse[e]]; }
+
+    /// Add or replace the component of an entity
+    T& emplace(Entity e, T component) {
+        if (e >= sparse.size())
+            sparse.resize(e + 1, kNullEntity);
+        if (has(e))
+            return dense[sparse[e]] = std::move(component);
+        sparse[e] = dense.size();
+        dense.push_back(std::move(component));
+        entities.push_back(e);
+        return dense.back();
+    }
+
+    /// Remove the component of an entity, if any, by moving the last one into its slot
+    void remove(Entity e) {
+        if (!has(e)) return;
+        uint32_t idx = sparse[e];
+        dense[idx] = std::move(dense.back());
+        entities[idx] = entities.back();
+        sparse[entities[idx]] = idx;
+        dense.pop_back();
+        entities.pop_back();
+        sparse[e] = kNullEntity;
+    }
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+/// Chunked Grid
+
+/// Edge length of a grid chunk, in cells
+constexpr uint32_t kChunkSize = 16;
+constexpr uint32_t kChunkVolume = kChunkSize * kChunkSize * kChunkSize;
+
+/// Pack a cell or chunk coordinate into a single hash key, 21 bits per axis
+inline uint64_t pack_coord(glm::uvec3 p) { return (uint64_t)p.x << 42 | (uint64_t)p.y << 21 | (uint64_t)p.z; }
+
+/// Cubic block of cells stored as indices into a palette of the distinct values it holds.
+/// Indices are bit-packed with just enough bits for the palette, a uniform chunk stores no indices.
+template<typename T>
+struct PaletteChunk {
+    std::vector<T> palette;        // palette[0] is the value the chunk was created with
+    std::vector<uint64_t> words;   // packed palette indices
+    uint32_t bits_per_cell = 0;    // 0, 1, 2, 4, 8 or 16, so cells never straddle words
+    uint32_t num_filled = 0;       // number of cells not set to the empty value of the grid
+
+    static PaletteChunk create(const T& value) { return { {value}, {}, 0, 0 }; }
+
+    /// Cell index inside the chunk, k varies fastest so columns are contiguous
+    static uint32_t index(glm::uvec3 local) { return (local.x * kChunkSize + local.y) * kChunkSize + local.z; }
+
+    /// Palette index of a cell
+    uint32_t entry(uint32_t idx) const {
+        if (bits_per_cell == 0) return 0;
+        uint32_t bit = idx * bits_per_cell;
+        uint64_t mask = (uint64_t(1) << bits_per_cell) - 1;
+        return (words[bit / 64] >> (bit % 64)) & mask;
+    }
+
+    const T& get(uint32_t idx) const { return palette[entry(idx)]; }
+
+    void set(uint32_t idx, const T& value) {
+        auto it = std::find(palette.begin(), palette.end(), value);
+        uint32_t new_entry = it - palette.begin();
+        if (it == palette.end()) {
+            palette.push_back(value);
+            if (palette.size() > (size_t(1) << bits_per_cell))
+                repack(bits_per_cell ? bits_per_cell * 2 : 1);
+        }
+        if (bits_per_cell == 0) return;
+        uint32_t bit = idx * bits_per_cell;
+        uint64_t mask = (uint64_t(1) << bits_per_cell) - 1;
+        uint64_t& word = words[bit / 64];
+        word = (word & ~(mask << (bit % 64))) | (uint64_t(new_entry) << (bit % 64));
+    }
+
+    /// Re-encode all indices with a wider bit count
+    void repack(uint32_t new_bits_per_cell) {
+        PaletteChunk wider = { palette, std::vector<uint64_t>(kChunkVolume * new_bits_per_cell / 64, 0), new_bits_per_cell, num_filled };
+        uint64_t mask = (uint64_t(1) << new_bits_per_cell) - 1;
+        for (uint32_t idx = 0; bits_per_cell && idx < kChunkVolume; idx++) {
+            uint32_t bit = idx * new_bits_per_cell;
+            wider.words[bit / 64] |= (uint64_t(entry(idx)) & mask) << (bit % 64);
+        }
+        *this = std::move(wider);
+    }
+
+    /// Append the chunk run-length encoded column by column, as (value, length) byte pairs.
+    /// Values must fit in a byte.
+    void encode_rle(std::vector<uint8_t>& out) const {
+        for (uint32_t column = 0; column < kChunkVolume; column += kChunkSize) {
+            for (uint32_t idx = column; idx < column + kChunkSize;) {
+                uint32_t run_end = idx + 1;
+                while (run_end < column + kChunkSize && entry(run_end) == entry(idx)) run_end++;
+                out.push_back((uint8_t)get(idx));
+                out.push_back((uint8_t)(run_end - idx));
+                idx = run_end;
+            }
+        }
+    }
+
+    /// Build a chunk from all its cell values at once, each cell written once with the final bit count
+    static PaletteChunk from_cells(const std::array<T, kChunkVolume>& cells, const T& empty) {
+        PaletteChunk chunk = create(empty);
+        std::array<uint16_t, kChunkVolume> entries;
+        for (uint32_t idx = 0; idx < kChunkVolume; idx++) {
+            // cells mostly come in runs along columns
+            if (idx > 0 && cells[idx] == cells[idx - 1]) {
+                entries[idx] = entries[idx - 1];
+            } else {
+                auto it = std::find(chunk.palette.begin(), chunk.palette.end(), cells[idx]);
+                if (it == chunk.palette.end()) it = chunk.palette.insert(it, cells[idx]);
+                entries[idx] = it - chunk.palette.begin();
+            }
+            chunk.num_filled += (cells[idx] != empty);
+        }
+        while (chunk.palette.size() > (size_t(1) << chunk.bits_per_cell))
+            chunk.bits_per_cell = chunk.bits_per_cell ? chunk.bits_per_cell * 2 : 1;
+        if (chunk.bits_per_cell == 0) return chunk;
+        chunk.words.assign(kChunkVolume * chunk.bits_per_cell / 64, 0);
+        for (uint32_t idx = 0; idx < kChunkVolume; idx++) {
+            uint32_t bit = idx * chunk.bits_per_cell;
+            chunk.words[bit / 64] |= uint64_t(entries[idx]) << (bit % 64);
+        }
+        return chunk;
+    }
+
+    /// Decode a chunk written by encode_rle, nullopt if the data is malformed or holds a value >= value_limit
+    static std::optional<PaletteChunk> decode_rle(const uint8_t* data, size_t size, const T& empty, uint32_t value_limit) {
+        std::array<T, kChunkVolume> cells;
+        uint32_t idx = 0;
+        for (size_t n = 0; n + 1 < size && idx < kChunkVolume; n += 2) {
+            uint32_t length = data[n + 1];
+            if (length == 0 || (idx % kChunkSize) + length > kChunkSize) return std::nullopt;
+            if (data[n] >= value_limit) return std::nullopt;
+            std::fill_n(cells.begin() + idx, length, (T)data[n]);
+            idx += length;
+        }
+        if (idx != kChunkVolume) return std::nullopt;
+        return from_cells(cells, empty);
+    }
+};
+
+/// Chunk of a world file, run-length encoded, waiting to be decoded on first access
+struct EncodedChunk {
+    const uint8_t* data;
+    uint32_t size;
+    uint64_t value_mask;  // bit (value % 64) set for each value held, to skip it in searches
+    uint32_t value_limit; // values at or above it mark the chunk as malformed
+};
+
+/// Sparse 3D grid of cells, split in chunks which are only allocated while holding a non-empty cell.
+/// Lets worlds of hundreds of millions of cells live in memory proportional to what is built in them.
+template<typename T>
+struct ChunkedGrid {
+    glm::uvec3 size;
+    T empty;
+    /// Decoded chunks, mutable as chunks still encoded are decoded by const lookups
+    mutable std::unordered_map<uint64_t, PaletteChunk<T>> chunks;
+    /// Chunks loaded from a world file that nothing accessed yet
+    mutable std::unordered_map<uint64_t, EncodedChunk> encoded;
+
+    static ChunkedGrid create(glm::uvec3 size, const T& empty) { return { size, empty, {}, {} }; }
+
+    bool contains(int i, int j, int k) const {
+        return i >= 0 && j >= 0 && k >= 0 && i < (int)size.x && j < (int)size.y && k < (int)size.z;
+    }
+
+    /// Chunk holding a cell, nullptr if not allocated
+    const PaletteChunk<T>* find_chunk(glm::uvec3 p) const {
+        uint64_t key = pack_coord(p / kChunkSize);
+        auto it = chunks.find(key);
+        if (it != chunks.end()) return &it->second;
+        return encoded.empty() ? nullptr : decode_chunk(key);
+    }
+
+    /// Decode a chunk still encoded, nullptr if there is none with that key.
+    /// A malformed chunk is dropped, as if it was empty.
+    const PaletteChunk<T>* decode_chunk(uint64_t key) const {
+        auto it = encoded.find(key);
+        if (it == encoded.end()) return nullptr;
+        std::optional<PaletteChunk<T>> chunk = PaletteChunk<T>::decode_rle(it->second.data, it->second.size, empty, it->second.value_limit);
+        encoded.erase(it);
+        if (!chunk || chunk->num_filled == 0) return nullptr;
+        return &chunks.emplace(key, std::move(*chunk)).first->second;
+    }
+
+    void decode_all() const {
+        while (!encoded.empty())
+            decode_chunk(encoded.begin()->first);
+    }
+
+    T get(glm::uvec3 p) const {
+        const PaletteChunk<T>* chunk = find_chunk(p);
+        return chunk ? chunk->get(PaletteChunk<T>::index(p % kChunkSize)) : empty;
+    }
+    T operator()(size_t i, size_t j, size_t k) const { return get(glm::uvec3(i, j, k)); }
+
+    void set(glm::uvec3 p, const T& value) {
+        uint64_t key = pack_coord(p / kChunkSize);
+        if (!encoded.empty()) decode_chunk(key);
+        auto it = chunks.find(key);
+        if (it == chunks.end()) {
+            if (value == empty) return;
+            it = chunks.emplace(key, PaletteChunk<T>::create(empty)).first;
+        }
+        PaletteChunk<T>& chunk = it->second;
+        uint32_t idx = PaletteChunk<T>::index(p % kChunkSize);
+        const T old = chunk.get(idx);
+        chunk.set(idx, value);
+        chunk.num_filled += (old == empty && value != empty);
+        chunk.num_filled -= (old != empty && value == empty);
+        if (chunk.num_filled == 0)
+            chunks.erase(it);
+    }
+
+    /// Height of the topmost non-empty cell of the column at (i, j), -1 if there is none.
+    /// Whole chunks that are not allocated are skipped.
+    int column_top(size_t i, size_t j) const {
+        for (int chunk_k = (size.z - 1) / kChunkSize; chunk_k >= 0; chunk_k--) {
+            const PaletteChunk<T>* chunk = find_chunk(glm::uvec3(i, j, chunk_k * kChunkSize));
+            if (!chunk) continue;
+            int k_end = std::min<int>(size.z, (chunk_k + 1) * kChunkSize);
+            for (int k = k_end - 1; k >= chunk_k * (int)kChunkSize; k--) {
+                if (chunk->get(PaletteChunk<T>::index(glm::uvec3(i, j, k) % kChunkSize)) != empty)
+                    return k;
+            }
+        }
+        return -1;
+    }
+
+    /// Invoke fn(cell) for every cell set to value, skipping chunks whose palette doesn't hold it
+    template<typename F>
+    void for_each(const T& value, F&& fn) const {
+        for (auto it = encoded.begin(); it != encoded.end();) {
+            auto [key, chunk] = *it++;
+            if (chunk.value_mask & (uint64_t(1) << ((uint64_t)value % 64)))
+                decode_chunk(key);
+        }
+        for (const auto& [key, chunk] : chunks) {
+            if (std::find(chunk.palette.begin(), chunk.palette.end(), value) == chunk.palette.end()) continue;
+            glm::uvec3 origin = glm::uvec3(key >> 42, (key >> 21) & 0x1FFFFF, key & 0x1FFFFF) * kChunkSize;
+            for (uint32_t idx = 0; idx < kChunkVolume; idx++) {
+                if (!(chunk.get(idx) == value)) continue;
+                glm::uvec3 local = { idx / (kChunkSize * kChunkSize), idx / kChunkSize % kChunkSize, idx % kChunkSize };
+                glm::uvec3 p = origin + local;
+                if (contains(p.x, p.y, p.z)) fn(p);
+            }
+        }
+    }
+
+    /// Approximate heap memory held by the grid, in bytes
+    size_t memory_usage() const {
+        size_t bytes = chunks.bucket_count() * sizeof(void*);
+        for (const auto& [key, chunk] : chunks)
+            bytes += sizeof(chunk) + 16 + chunk.palette.capacity() * sizeof(T) + chunk.words.capacity() * sizeof(uint64_t);
+        bytes += encoded.size() * (sizeof(EncodedChunk) + 16);
+        return bytes;
+    }
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+/// World File
+
+/// Layout of a world file, all integers little-endian:
+///   WorldFileHeader
+///   chunk records, each the RLE tilemap chunk followed by the RLE visibility chunk, if any
+///   visible_tops and ray_tops of the Map, as int32 arrays
+///   WorldChunkEntry table, one per chunk record in use
+/// Saving appends the records of edited chunks and a new table, then rewrites the header,
+/// so records replaced since the file was written are left behind as garbage until the next full save.
+constexpr uint32_t kWorldFileMagic = 0x4F53494D;  // "MISO"
+constexpr uint32_t kWorldFileVersion = 1;
+
+struct WorldFileHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t size[3];       // map size in cells
+    uint32_t chunk_size;    // must match kChunkSize
+    uint64_t tops_offset;   // offset of visible_tops, followed by ray_tops
+    uint64_t table_offset;  // offset of the chunk table
+    uint64_t num_chunks;    // number of entries in the chunk table
+};
+
+struct WorldChunkEntry {
+    uint64_t key;            // chunk coordinate, as packed by pack_coord
+    uint64_t offset;         // offset of the chunk record
+    uint32_t tiles_size;     // bytes of the tilemap chunk
+    uint32_t visible_size;   // bytes of the visibility chunk, 0 if no block of the chunk is visible
+    uint64_t tiles_mask;     // EncodedChunk::value_mask of the tilemap chunk
+};
+
+/// Read-only memory mapping of a whole file, unmapped when the last reference goes away
+struct MappedFile {
+    const uint8_t* data;
+    size_t size;
+
+    static std::shared_ptr<MappedFile> open(const std::string& path) {
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) return nullptr;
+        struct stat st;
+        void* data = (fstat(fd, &st) == 0 && st.st_size > 0) ? mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+        ::close(fd);
+        if (data == MAP_FAILED) return nullptr;
+        return std::shared_ptr<MappedFile>(new MappedFile{ (const uint8_t*)data, (size_t)st.st_size }, [](MappedFile* file) {
+            munmap((void*)file->data, file->size);
+            delete file;
+        });
+    }
+};
+
+/// World file a Map was loaded from or last saved to
+struct WorldFile {
+    std::string path;
+    std::shared_ptr<MappedFile> mapping;  // backs the chunks of the map still encoded, null after a full save
+    std::unordered_map<uint64_t, WorldChunkEntry> table;
+    uint64_t file_size;                   // bytes in the file, new records are appended here
+    uint64_t garbage_size;                // bytes of records no longer in the table
+};
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 /// Forward-declarations
 
@@ -338,7 +1094,7 @@ enum class GameMode {
     CREATIVE,
 };
 
-/// Game Object represents an Entity's data
+/// Game Object describes all components of an Entity before it is spawned into the World
 struct GameObject {
     Transform transform;
     Motion motion;
@@ -346,7 +1102,76 @@ struct GameObject {
     GLTextureRef texture;
     std::optional<SpriteAnimation> sprite_animation;
     std::optional<Gravity> gravity;
-    std::optional<Highlight> highlight;
+};
+
+/// Mesh component, geometry and texture to render an entity with
+struct Mesh {
+    GLObjectRef glo;
+    GLTextureRef texture;
+};
+
+/// All entities of a Scene, with their components in dense per-component arrays
+struct World {
+    Entity num_entities = 0;
+    std::vector<Entity> free_entities;
+    ComponentArray<Transform> transforms;
+    ComponentArray<Motion> motions;
+    ComponentArray<Mesh> meshes;
+    ComponentArray<SpriteAnimation> sprite_animations;
+    ComponentArray<Gravity> gravities;
+    /// The per-tick systems only visit these, so their cost follows the number of changing entities
+    ComponentArray<Active> actives;
+
+    /// Create a new entity with the components described by a GameObject.
+    /// Motion is only stored for objects that move or fall.
+    Entity spawn(GameObject&& obj) {
+        Entity e = num_entities;
+        if (free_entities.empty()) num_entities++;
+        else { e = free_entities.back(); free_entities.pop_back(); }
+        transforms.emplace(e, obj.transform);
+        if (obj.gravity || obj.motion.velocity != glm::vec2(0.f) || obj.motion.acceleration != glm::vec2(0.f))
+            motions.emplace(e, Motion{ obj.motion.velocity, obj.motion.acceleration, obj.transform.position });
+        if (obj.glo && obj.texture)
+            meshes.emplace(e, Mesh{ std::move(obj.glo), std::move(obj.texture) });
+        if (obj.sprite_animation) sprite_animations.emplace(e, std::move(*obj.sprite_animation));
+        if (obj.gravity) gravities.emplace(e, *obj.gravity);
+        if (motions.has(e) || (obj.sprite_animation && !obj.sprite_animation->freeze))
+            actives.emplace(e, Active{});
+        return e;
+    }
+
+    /// Remove all components of an entity and recycle its identifier
+    void destroy(Entity e) {
+        transforms.remove(e);
+        motions.remove(e);
+        meshes.remove(e);
+        sprite_animations.remove(e);
+        gravities.remove(e);
+        actives.remove(e);
+        free_entities.push_back(e);
+    }
+
+    /// Make an entity start falling
+    void add_gravity(Entity e) {
+        gravities.emplace(e, Gravity{});
+        if (!motions.has(e))
+            motions.emplace(e, Motion{ .prev_position = transforms[e].position });
+        actives.emplace(e, Active{});
+    }
+
+    /// Stop a fallen entity where it is. It keeps Gravity, which marks the hole it left behind.
+    void settle(Entity e) {
+        motions.remove(e);
+        actives.remove(e);
+    }
+
+    /// Transform of an entity at render time, interpolated between the last two ticks
+    Transform interpolated(Entity e, float alpha) {
+        Transform transform = transforms[e];
+        if (Motion* motion = motions.get(e))
+            transform.position = glm::mix(motion->prev_position, transform.position, alpha);
+        return transform;
+    }
 };
 
 enum ObjectType {
@@ -359,18 +1184,199 @@ enum ObjectType {
     COUNT,
 };
 
+/// Whether a block fully covers whatever is drawn behind it
+inline bool is_opaque(ObjectType block) { return block != ObjectType::AIR && block != ObjectType::BOOK; }
+
+/// Static blocks of the world
 struct Map {
-    glm::uvec3 size;
-    std::vector<std::vector<std::vector<ObjectType>>> tilemap;
+    ChunkedGrid<ObjectType> tilemap;
+    /// 1 for blocks that contribute pixels to the isometric view
+    ChunkedGrid<uint8_t> visible;
+    /// Height of the topmost visible block of each column (i, j), -1 if there is none
+    std::vector<int> visible_tops;
+    /// Height of the frontmost non-air block of each ray (a, b), -1 if there is none, see ray_of
+    std::vector<int> ray_tops;
+    /// Cells edited since the last flush, derived data around them is stale until then
+    std::vector<glm::uvec3> dirty_cells;
+    /// Chunks edited since the map was last loaded or saved
+    std::unordered_set<uint64_t> unsaved_chunks;
+    std::optional<WorldFile> file;
+
+    static size_t num_columns(glm::uvec3 size) { return (size_t)size.x * size.y; }
+    static size_t num_rays(glm::uvec3 size) { return (size_t)(size.x + size.z - 1) * (size.y + size.z - 1); }
+
+    static Map create(glm::uvec3 size) {
+        return {
+            .tilemap = ChunkedGrid<ObjectType>::create(size, ObjectType::AIR),
+            .visible = ChunkedGrid<uint8_t>::create(size, 0),
+            .visible_tops = std::vector<int>(num_columns(size), -1),
+            .ray_tops = std::vector<int>(num_rays(size), -1),
+        };
+    }
+
+    /// Cell (i-1, j+1, k+1) projects to the same screen position as (i, j, k) and is drawn after it,
+    /// so an opaque block there hides the block at (i, j, k) entirely.
+    bool is_hidden(glm::uvec3 p) const {
+        glm::ivec3 front = glm::ivec3(p) + glm::ivec3(-1, +1, +1);
+        return tilemap.contains(front.x, front.y, front.z) && is_opaque(tilemap.get(front));
+    }
+
+    int visible_top(size_t i, size_t j) const { return visible_tops[i * tilemap.size.y + j]; }
+
+    /// Cells (i-n, j+n, k+n) all project to the same screen position, forming a ray into the screen.
+    /// A ray is identified by a = i+k in [0, size.x+size.z-1) and b = j-k in (-size.z, size.y).
+    static glm::ivec2 ray_of(glm::uvec3 p) { return { p.x + p.z, (int)p.y - (int)p.z }; }
+
+    bool has_ray(glm::ivec2 ray) const {
+        glm::ivec3 size = tilemap.size;
+        return ray.x >= 0 && ray.x < size.x + size.z - 1 && ray.y > -size.z && ray.y < size.y;
+    }
+
+    int ray_top(glm::ivec2 ray) const {
+        return ray_tops[ray.x * (tilemap.size.y + tilemap.size.z - 1) + ray.y + tilemap.size.z - 1];
+    }
+
+    /// Frontmost block on a ray, the one seen at its screen position, nullopt if the ray is empty
+    std::optional<glm::uvec3> pick(glm::ivec2 ray) const {
+        if (!has_ray(ray)) return std::nullopt;
+        int k = ray_top(ray);
+        if (k < 0) return std::nullopt;
+        return glm::uvec3(ray.x - k, ray.y + k, k);
+    }
+
+    void update_ray(glm::uvec3 p) {
+        glm::ivec2 ray = ray_of(p);
+        int& top = ray_tops[ray.x * (tilemap.size.y + tilemap.size.z - 1) + ray.y + tilemap.size.z - 1];
+        if (tilemap.get(p) != ObjectType::AIR) {
+            top = std::max(top, (int)p.z);
+            return;
+        }
+        if ((int)p.z != top) return;
+        // the frontmost block was removed, look for the next one behind it
+        for (top = p.z - 1; top >= 0; top--) {
+            glm::ivec3 q(ray.x - top, ray.y + top, top);
+            if (tilemap.contains(q.x, q.y, q.z) && tilemap.get(q) != ObjectType::AIR)
+                break;
+        }
+    }
+
+    void update_visibility(glm::uvec3 p) {
+        bool is_visible = tilemap.get(p) != ObjectType::AIR && !is_hidden(p);
+        if (visible.get(p) == is_visible) return;
+        visible.set(p, is_visible);
+        int& top = visible_tops[p.x * tilemap.size.y + p.y];
+        if (is_visible && (int)p.z > top) top = p.z;
+        else if (!is_visible && (int)p.z == top) top = visible.column_top(p.x, p.y);
+    }
+
+    /// Recompute all derived data from the tilemap, chunk columns in parallel
+    void rebuild(unsigned num_threads) {
+        ScopeTimer timer("Map rebuild");
+        tilemap.decode_all();  // lookups must not decode chunks while shared between threads
+        visible = ChunkedGrid<uint8_t>::create(tilemap.size, 0);
+        glm::uvec3 num_chunks = (tilemap.size + kChunkSize - 1u) / kChunkSize;
+        // visibility, each thread builds the chunks and column tops of whole chunk columns
+        std::vector<std::vector<std::pair<uint64_t, PaletteChunk<uint8_t>>>> visible_chunks(num_chunks.x * num_chunks.y);
+        parallel_for(visible_chunks.size(), num_threads, [&](size_t n) {
+            glm::uvec3 chunk_p(n / num_chunks.y, n % num_chunks.y, 0);
+            for (uint32_t l = 0; l < kChunkSize * kChunkSize; l++) {
+                glm::uvec3 p = chunk_p * kChunkSize + glm::uvec3(l / kChunkSize, l % kChunkSize, 0);
+                if (tilemap.contains(p.x, p.y, 0)) visible_tops[p.x * tilemap.size.y + p.y] = -1;
+            }
+            std::array<uint8_t, kChunkVolume> cells;
+            for (chunk_p.z = 0; chunk_p.z < num_chunks.z; chunk_p.z++) {
+                const PaletteChunk<ObjectType>* chunk = tilemap.find_chunk(chunk_p * kChunkSize);
+                if (!chunk) continue;
+                // chunks holding the cells in front, indexed by the faces of this chunk the front cell crosses:
+                // 4 for i-1 on the low x face, 2 for j+1 on the high y face, 1 for k+1 on the high z face
+                std::array<const PaletteChunk<ObjectType>*, 8> fronts;
+                for (int f = 0; f < 8; f++) {
+                    glm::ivec3 q = glm::ivec3(chunk_p * kChunkSize) + glm::ivec3((f & 4) ? -1 : 0, (f & 2) ? kChunkSize : 0, (f & 1) ? kChunkSize : 0);
+                    fronts[f] = tilemap.contains(q.x, q.y, q.z) ? tilemap.find_chunk(glm::uvec3(q)) : nullptr;
+                }
+                for (uint32_t idx = 0; idx < kChunkVolume; idx++) {
+                    glm::uvec3 local = { idx / (kChunkSize * kChunkSize), idx / kChunkSize % kChunkSize, idx % kChunkSize };
+                    cells[idx] = 0;
+                    if (chunk->get(idx) == ObjectType::AIR) continue;
+                    int f = (local.x == 0) * 4 + (local.y + 1 == kChunkSize) * 2 + (local.z + 1 == kChunkSize);
+                    glm::uvec3 front = (local + glm::uvec3(kChunkSize - 1, 1, 1)) % kChunkSize;
+                    cells[idx] = !(fronts[f] && is_opaque(fronts[f]->get(PaletteChunk<ObjectType>::index(front))));
+                    glm::uvec3 p = chunk_p * kChunkSize + local;
+                    if (cells[idx]) visible_tops[p.x * tilemap.size.y + p.y] = p.z;
+                }
+                PaletteChunk<uint8_t> visible_chunk = PaletteChunk<uint8_t>::from_cells(cells, 0);
+                if (visible_chunk.num_filled)
+                    visible_chunks[n].emplace_back(pack_coord(chunk_p), std::move(visible_chunk));
+            }
+        });
+        for (auto& chunks : visible_chunks)
+            for (auto& [key, chunk] : chunks) visible.chunks.emplace(key, std::move(chunk));
+
+        // the frontmost block of a ray is never hidden, so only visible cells are looked up,
+        // and visible_tops rules out most of them without a lookup
+        int num_rays_b = tilemap.size.y + tilemap.size.z - 1;
+        int max_top = *std::max_element(visible_tops.begin(), visible_tops.end());
+        parallel_for(tilemap.size.x + tilemap.size.z - 1, num_threads, [&](size_t a) {
+            for (int b = 1 - (int)tilemap.size.z; b < (int)tilemap.size.y; b++) {
+                int& top = ray_tops[a * num_rays_b + b + tilemap.size.z - 1];
+                for (top = max_top; top >= 0; top--) {
+                    glm::ivec3 q(a - top, b + top, top);
+                    if (tilemap.contains(q.x, q.y, q.z) && top <= visible_top(q.x, q.y) && visible.get(q))
+                        break;
+                }
+            }
+        });
+        dirty_cells.clear();
+    }
+
+    /// Set a block, its derived data is refreshed on the next flush
+    void set(glm::uvec3 p, ObjectType block) {
+        tilemap.set(p, block);
+        dirty_cells.push_back(p);
+    }
+
+    /// Refresh the visibility, column tops and ray tops of the edited cells and of the blocks behind them
+    void flush() {
+        ScopeTimer timer("Map flush");
+        for (glm::uvec3 p : dirty_cells) {
+            update_ray(p);
+            update_visibility(p);
+            unsaved_chunks.insert(pack_coord(p / kChunkSize));
+            glm::ivec3 back = glm::ivec3(p) + glm::ivec3(+1, -1, -1);
+            if (tilemap.contains(back.x, back.y, back.z)) {
+                update_visibility(back);
+                unsaved_chunks.insert(pack_coord(glm::uvec3(back) / kChunkSize));
+            }
+        }
+        dirty_cells.clear();
+    }
 };
 
 /// Generic Scene structure
 struct Scene {
     glm::vec4 bg_color;
-    std::vector<std::vector<std::vector<GameObject>>> platform;
+    World world;
+    /// Dynamic entities (player, books, falling blocks) by map cell, sorted in draw order
+    std::map<uint64_t, Entity> objects;
     glm::uvec3 player_idx;
     std::optional<glm::uvec3> highlight_idx;
-    GameObject& player() { auto p = player_idx; return platform[p.x][p.y][p.z]; }
+
+    /// Key of a cell in draw order: i descending, then j and k ascending
+    static uint64_t draw_key(glm::uvec3 p) { return pack_coord(glm::uvec3(0x1FFFFF - p.x, p.y, p.z)); }
+    /// Map cell of a draw key
+    static glm::uvec3 draw_cell(uint64_t key) {
+        return { 0x1FFFFF - (key >> 42), (key >> 21) & 0x1FFFFF, key & 0x1FFFFF };
+    }
+    /// Entity at a map cell, kNullEntity if none
+    Entity object_at(glm::uvec3 p) const {
+        auto it = objects.find(draw_key(p));
+        return it != objects.end() ? it->second : kNullEntity;
+    }
+    void set_object(glm::uvec3 p, Entity e) {
+        if (e == kNullEntity) objects.erase(draw_key(p));
+        else objects[draw_key(p)] = e;
+    }
+    Entity player() const { return object_at(player_idx); }
 };
 
 /// All Game data
@@ -380,75 +1386,296 @@ struct Game {
     Window window;
     Viewport viewport;
     glm::vec2 cursor;
+    std::optional<glm::vec2> drag_begin;  // cursor position where the left button went down, in creative mode
     float zoom;
-    GLuint shader_program;
+    ShaderProgram shader_program;
+    std::optional<CameraUniformBuffer> camera_ubo;
+    GeometryCacheRef geometry_cache;
+    TextureCacheRef texture_cache;
     GLObjectRef canvas_quad_glo;
+    GLObjectRef surface_quad_glo;  // tile surface outline drawn by render_surface, built on first use
     GLTextureRef white_texture;
     GLTextureRef black_texture;
     GLTextureRef block_texture;
+    std::array<GLObjectRef, ObjectType::COUNT> block_glos;  // quad of each block type, null for non-blocks
+    std::array<glm::vec2, ObjectType::COUNT> block_texoffsets;  // tile of each block type in the tileset
+    std::optional<BlockBatch> block_batch;
     std::optional<Camera> camera;
     std::optional<Map> map;
     std::optional<Scene> scene;
     std::optional<KeyStateMap> key_states;
     std::vector<TimedAction> timed_actions;
     int books_collected_count;
+    int books_total_count;
     bool debug_triangles;
     ObjectType target_objtype;
     GameObject target_obj;
 };
 
+/// Small stateless-seeded PRNG (splitmix64)
+struct Rng {
+    uint64_t state;
+
+    uint64_t next() {
+        uint64_t z = (state += 0x9E3779B97F4A7C15);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EB;
+        return z ^ (z >> 31);
+    }
+    /// Uniform in [0, 1)
+    float uniform() { return (next() >> 40) * (1.f / (1 << 24)); }
+};
+
+/// Hash of a seed and a lattice coordinate, independent of the order anything is generated in
+inline uint64_t hash_coord(uint64_t seed, int64_t x, int64_t y)
+{
+    return Rng{ seed ^ (uint64_t)x * 0xD6E8FEB86659FD93 ^ (uint64_t)y * 0xA0761D6478BD642F }.next();
+}
+
+/// Value noise in [0, 1): hashed values at integer points, smoothly interpolated in between
+float value_noise(uint64_t seed, float x, float y)
+{
+    float x0 = std::floor(x), y0 = std::floor(y);
+    auto lattice = [&](float dx, float dy) {
+        return (hash_coord(seed, x0 + dx, y0 + dy) >> 40) * (1.f / (1 << 24));
+    };
+    auto smooth = [](float t) { return t * t * (3.f - 2.f * t); };
+    float tx = smooth(x - x0), ty = smooth(y - y0);
+    return glm::mix(glm::mix(lattice(0, 0), lattice(1, 0), tx), glm::mix(lattice(0, 1), lattice(1, 1), tx), ty);
+}
+
+/// Octaves of value noise, each at double the frequency and half the amplitude, normalized to [0, 1)
+float fractal_noise(uint64_t seed, float x, float y, int octaves)
+{
+    float sum = 0.f, amplitude = 1.f, total = 0.f;
+    for (int o = 0; o < octaves; o++) {
+        sum += value_noise(seed + o, x, y) * amplitude;
+        total += amplitude;
+        amplitude *= 0.5f;
+        x *= 2.f;
+        y *= 2.f;
+    }
+    return sum / total;
+}
+
+constexpr float kTerrainScale = 24.f;      // cells across the coarsest hills
+constexpr int kTerrainMaxHeight = 8;       // highest ground, when the map is tall enough
+constexpr float kTreeDensity = 0.03f;      // fraction of columns with a tree
+constexpr float kBookDensity = 0.025f;     // fraction of columns with a book, in COLLECT_BOOKS mode
+constexpr int kTreeTrunkHeight = 2;
+
+/// Contents of one generated column, bottom to top: stone, grass, then a tree or a book on top
+struct TerrainColumn {
+    int ground;       // height of the grass block
+    int trunk;        // wood blocks above the ground, topped with a plank crown if any
+    bool book;
+
+    ObjectType block_at(int k) const {
+        if (k < ground) return ObjectType::STONE;
+        if (k == ground) return ObjectType::GRASS;
+        if (k <= ground + trunk) return ObjectType::WOOD;
+        if (trunk && k == ground + trunk + 1) return ObjectType::WOODPLANK;
+        if (book && k == ground + 1) return ObjectType::BOOK;
+        return ObjectType::AIR;
+    }
+};
+
+/// Generate a map from a seed. Each chunk column is filled independently on its own thread, its
+/// features drawn from a PRNG seeded with the seed and the chunk coordinate, so the result
+/// only depends on the seed and size, never on the thread count.
+Map generate_terrain(glm::uvec3 size, uint64_t seed, bool with_books, unsigned num_threads)
+{
+    ScopeTimer timer("generate_terrain");
+    Map map = Map::create(size);
+    int max_height = std::clamp<int>(size.z - 4, 0, kTerrainMaxHeight);
+    glm::uvec3 num_chunks = (size + kChunkSize - 1u) / kChunkSize;
+    std::vector<std::vector<std::pair<uint64_t, PaletteChunk<ObjectType>>>> generated(num_chunks.x * num_chunks.y);
+    parallel_for(generated.size(), num_threads, [&](size_t n) {
+        glm::uvec3 chunk_p(n / num_chunks.y, n % num_chunks.y, 0);
+        Rng rng{ hash_coord(~seed, chunk_p.x, chunk_p.y) };
+        std::array<TerrainColumn, kChunkSize * kChunkSize> columns;
+        int chunk_top = 0;
+        for (uint32_t l = 0; l < columns.size(); l++) {
+            glm::uvec2 p = glm::uvec2(chunk_p) * kChunkSize + glm::uvec2(l / kChunkSize, l % kChunkSize);
+            TerrainColumn& column = columns[l];
+            float height = fractal_noise(seed, p.x / kTerrainScale, p.y / kTerrainScale, 3);
+            column.ground = std::min<int>(height * (max_height + 1), max_height);
+            // both draws always happen, keeping the sequence of every column the same
+            float tree = rng.uniform(), book = rng.uniform();
+            bool has_room = column.ground + kTreeTrunkHeight + 1 < (int)size.z;
+            column.trunk = (tree < kTreeDensity && has_room) ? kTreeTrunkHeight : 0;
+            column.book = with_books && !column.trunk && book < kBookDensity && column.ground + 1 < (int)size.z;
+            chunk_top = std::max(chunk_top, column.ground + column.trunk + 1);
+        }
+        // chunks above the highest column are left unallocated
+        std::array<ObjectType, kChunkVolume> cells;
+        for (chunk_p.z = 0; chunk_p.z < num_chunks.z && chunk_p.z * kChunkSize <= (uint32_t)chunk_top; chunk_p.z++) {
+            for (uint32_t l = 0; l < columns.size(); l++) {
+                glm::uvec3 p = chunk_p * kChunkSize + glm::uvec3(l / kChunkSize, l % kChunkSize, 0);
+                bool inside = map.tilemap.contains(p.x, p.y, 0);
+                for (uint32_t z = 0; z < kChunkSize; z++) {
+                    bool in_map = inside && p.z + z < size.z;
+                    cells[l * kChunkSize + z] = in_map ? columns[l].block_at(p.z + z) : ObjectType::AIR;
+                }
+            }
+            PaletteChunk<ObjectType> chunk = PaletteChunk<ObjectType>::from_cells(cells, ObjectType::AIR);
+            if (chunk.num_filled)
+                generated[n].emplace_back(pack_coord(chunk_p), std::move(chunk));
+        }
+    });
+    for (auto& chunks : generated)
+        for (auto& [key, chunk] : chunks) map.tilemap.chunks.emplace(key, std::move(chunk));
+    map.rebuild(num_threads);
+    return map;
+}
+
 /// Load entire map
 Map load_map(const Game& game)
 {
-    Map map;
-    map.size = {20, 20, 10};
-    map.tilemap = std::vector(map.size.x, std::vector(map.size.y, std::vector(map.size.z, ObjectType::AIR)));
-
-    ObjectType ground_blocks[] = {
-        ObjectType::GRASS,
-        ObjectType::GRASS,
-        ObjectType::GRASS,
-        ObjectType::STONE,
-        ObjectType::STONE,
-        ObjectType::STONE,
-        ObjectType::WOODPLANK,
+    uint64_t seed = g_world_seed.value_or(std::rand());
+    return generate_terrain(g_map_size, seed, game.mode == GameMode::COLLECT_BOOKS, g_num_threads);
+}
+
+/// Load a map from a world file, nullopt if it can't be read or is not a valid world file.
+/// Only the derived per-column data is read upfront, chunks are decoded from the mapping on first access.
+std::optional<Map> load_world_file(const std::string& path)
+{
+    ScopeTimer timer("load_world_file");
+    std::shared_ptr<MappedFile> mapping = MappedFile::open(path);
+    if (!mapping) return std::nullopt;
+    auto fail = [&](const char* reason) {
+        fprintf(stderr, "Failed to load world file %s: %s\n", path.c_str(), reason);
+        return std::nullopt;
     };
+    WorldFileHeader header;
+    if (mapping->size < sizeof(header)) return fail("truncated header");
+    std::memcpy(&header, mapping->data, sizeof(header));
+    if (header.magic != kWorldFileMagic) return fail("not a world file");
+    if (header.version != kWorldFileVersion) return fail("unsupported version");
+    if (header.chunk_size != kChunkSize) return fail("unsupported chunk size");
+    glm::uvec3 size(header.size[0], header.size[1], header.size[2]);
+    for (int n = 0; n < 3; n++)
+        if (size[n] == 0 || size[n] > 0x1FFFFF) return fail("invalid map size");
+
+    // checked before allocating, so a bogus size fails here instead of in the allocation
+    uint64_t tops_size = (uint64_t)(Map::num_columns(size) + Map::num_rays(size)) * sizeof(int);
+    if (header.tops_offset > mapping->size || mapping->size - header.tops_offset < tops_size) return fail("truncated column data");
+    Map map = Map::create(size);
+    std::memcpy(map.visible_tops.data(), mapping->data + header.tops_offset, map.visible_tops.size() * sizeof(int));
+    std::memcpy(map.ray_tops.data(), mapping->data + header.tops_offset + map.visible_tops.size() * sizeof(int), map.ray_tops.size() * sizeof(int));
+
+    if (header.table_offset > mapping->size || (mapping->size - header.table_offset) / sizeof(WorldChunkEntry) < header.num_chunks)
+        return fail("truncated chunk table");
+    WorldFile file{ .path = path, .mapping = mapping, .table = {}, .file_size = mapping->size, .garbage_size = 0 };
+    uint64_t live_size = sizeof(header) + tops_size + header.num_chunks * sizeof(WorldChunkEntry);
+    for (uint64_t n = 0; n < header.num_chunks; n++) {
+        WorldChunkEntry entry;
+        std::memcpy(&entry, mapping->data + header.table_offset + n * sizeof(entry), sizeof(entry));
+        if (entry.offset > mapping->size || mapping->size - entry.offset < (uint64_t)entry.tiles_size + entry.visible_size)
+            return fail("chunk out of bounds");
+        uint64_t chunk_x = entry.key >> 42, chunk_y = (entry.key >> 21) & 0x1FFFFF, chunk_z = entry.key & 0x1FFFFF;
+        if (chunk_x * kChunkSize >= size.x || chunk_y * kChunkSize >= size.y || chunk_z * kChunkSize >= size.z)
+            return fail("chunk outside of the map");
+        if (entry.tiles_mask >> ObjectType::COUNT) return fail("invalid block in chunk");
+        const uint8_t* data = mapping->data + entry.offset;
+        map.tilemap.encoded[entry.key] = EncodedChunk{ data, entry.tiles_size, entry.tiles_mask, ObjectType::COUNT };
+        if (entry.visible_size)
+            map.visible.encoded[entry.key] = EncodedChunk{ data + entry.tiles_size, entry.visible_size, ~uint64_t(0), 256 };
+        file.table[entry.key] = entry;
+        live_size += entry.tiles_size + entry.visible_size;
+    }
+    file.garbage_size = file.file_size - std::min(file.file_size, live_size);
+    map.file = std::move(file);
+    return map;
+}
 
-    for (int i = 0; i < (int)map.tilemap.size(); i++) {
-        for (int j = 0; j < (int)map.tilemap[i].size(); j++) {
-            int index = 0;
-            if (game.mode == GameMode::COLLECT_BOOKS)
-                index = std::rand() % sizeof(ground_blocks) / sizeof(ground_blocks[0]);
-            map.tilemap[i][j][0] = ground_blocks[index];
-        }
+/// Save a map to a world file. Saving again to the file the map came from only appends the chunks edited since,
+/// unless garbage outgrew the live data, then the whole file is rewritten. Returns false on failure.
+bool save_world_file(Map& map, const std::string& path)
+{
+    ScopeTimer timer("save_world_file");
+    map.flush();
+    bool incremental = map.file && map.file->path == path && map.file->garbage_size <= map.file->file_size / 2;
+    // a full save is written aside and renamed over, so the mapping of the old file stays valid until then
+    std::string write_path = incremental ? path : path + ".tmp";
+    FILE* f = fopen(write_path.c_str(), incremental ? "r+b" : "wb");
+    if (!f) {
+        fprintf(stderr, "Failed to save world file %s\n", path.c_str());
+        return false;
+    }
+    // the map keeps its file until the save succeeded, its still encoded chunks point into the mapping
+    WorldFile file = incremental ? *map.file : WorldFile{ .path = path, .mapping = nullptr, .table = {}, .file_size = 0, .garbage_size = 0 };
+    WorldFileHeader header{ .magic = kWorldFileMagic, .version = kWorldFileVersion,
+                            .size = { map.tilemap.size.x, map.tilemap.size.y, map.tilemap.size.z },
+                            .chunk_size = kChunkSize, .tops_offset = 0, .table_offset = 0, .num_chunks = 0 };
+    if (incremental) {
+        fseek(f, file.file_size, SEEK_SET);
+    } else {
+        fwrite(&header, sizeof(header), 1, f);
+        file.file_size = sizeof(header);
     }
 
-    //size_t i = 5;
-    //size_t j = 8;
-    //map.tilemap[i][j][1] = ObjectType::STONE;
-    //map.tilemap[i][j][2] = ObjectType::STONE;
-    //map.tilemap[i][j][3] = ObjectType::STONE;
-
-    //map.tilemap[i][j+1][1] = ObjectType::STONE;
-    //map.tilemap[i][j+1][2] = ObjectType::STONE;
-    //map.tilemap[i][j+1][3] = ObjectType::STONE;
-    //map.tilemap[i-1][j+1][3] = ObjectType::WOODPLANK;
-    //map.tilemap[i-1][j][3] = ObjectType::WOODPLANK;
-
-    if (game.mode == GameMode::COLLECT_BOOKS) {
-        // spawn books
-        for (int x = 0; x < 10; x++) {
-            int i = std::rand() % map.size.x;
-            int j = std::rand() % map.size.y;
-            if (map.tilemap[i][j][1] == ObjectType::BOOK) {
-                x--;
-                continue;
-            }
-            map.tilemap[i][j][1] = ObjectType::BOOK;
+    // chunk records
+    std::vector<uint64_t> keys;
+    if (incremental) {
+        keys.assign(map.unsaved_chunks.begin(), map.unsaved_chunks.end());
+    } else {
+        map.tilemap.decode_all();
+        map.visible.decode_all();
+        for (const auto& [key, chunk] : map.tilemap.chunks) keys.push_back(key);
+    }
+    size_t old_table_size = file.table.size();
+    std::vector<uint8_t> record;
+    for (uint64_t key : keys) {
+        if (auto it = file.table.find(key); it != file.table.end()) {
+            file.garbage_size += it->second.tiles_size + it->second.visible_size;
+            file.table.erase(it);
+        }
+        glm::uvec3 origin = glm::uvec3(key >> 42, (key >> 21) & 0x1FFFFF, key & 0x1FFFFF) * kChunkSize;
+        const PaletteChunk<ObjectType>* tiles = map.tilemap.find_chunk(origin);
+        if (!tiles) continue;
+        record.clear();
+        tiles->encode_rle(record);
+        WorldChunkEntry entry{ .key = key, .offset = file.file_size, .tiles_size = (uint32_t)record.size(), .visible_size = 0, .tiles_mask = 0 };
+        for (ObjectType block : tiles->palette)
+            entry.tiles_mask |= uint64_t(1) << (block % 64);
+        if (const PaletteChunk<uint8_t>* visible = map.visible.find_chunk(origin)) {
+            visible->encode_rle(record);
+            entry.visible_size = record.size() - entry.tiles_size;
         }
+        fwrite(record.data(), 1, record.size(), f);
+        file.file_size += record.size();
+        file.table[key] = entry;
     }
 
-    return map;
+    // per-column data and chunk table are rewritten whole, what they replace becomes garbage
+    if (incremental)
+        file.garbage_size += (map.visible_tops.size() + map.ray_tops.size()) * sizeof(int) + old_table_size * sizeof(WorldChunkEntry);
+    header.tops_offset = file.file_size;
+    fwrite(map.visible_tops.data(), sizeof(int), map.visible_tops.size(), f);
+    fwrite(map.ray_tops.data(), sizeof(int), map.ray_tops.size(), f);
+    file.file_size += (map.visible_tops.size() + map.ray_tops.size()) * sizeof(int);
+    header.table_offset = file.file_size;
+    header.num_chunks = file.table.size();
+    for (const auto& [key, entry] : file.table)
+        fwrite(&entry, sizeof(entry), 1, f);
+    file.file_size += file.table.size() * sizeof(WorldChunkEntry);
+
+    // the header goes last, so an interrupted save leaves the previous state of the file readable
+    fflush(f);
+    fseek(f, 0, SEEK_SET);
+    fwrite(&header, sizeof(header), 1, f);
+    bool ok = !ferror(f);
+    ok = (fclose(f) == 0) && ok;
+    if (ok && !incremental)
+        ok = (std::rename(write_path.c_str(), path.c_str()) == 0);
+    if (!ok) {
+        fprintf(stderr, "Failed to save world file %s\n", path.c_str());
+        return false;
+    }
+    map.file = std::move(file);
+    map.unsaved_chunks.clear();
+    return true;
 }
 
 constexpr glm::vec2 blocks_tileset_size{526.f, 232.f};
@@ -462,15 +1689,22 @@ static const std::unordered_map<ObjectType, glm::vec2> blocks_offset = {
     {ObjectType::WOOD, {0.f, 116.f}},
 };
 
-GameObject create_block_object(const Game& game, glm::ivec3 p, ObjectType block)
+/// Canvas position of the block at a map cell
+glm::vec2 block_position(const Game& game, glm::ivec3 p)
 {
     int i = p.x, j = p.y, k = p.z;
+    return {
+        i * 0.5f + j * 0.5f - /*canvas offset*/(game.map->tilemap.size.x / 2.f),
+        i * 0.25f - j * 0.25f + k * 0.5f - /*canvas offset*/0.5f,
+    };
+}
+
+GameObject create_block_object(const Game& game, glm::ivec3 p, ObjectType block)
+{
     GameObject obj{};
-    auto [vertices, indices] = gen_quad_geometry(glm::vec2(1.f), blocks_offset.at(block) / blocks_tileset_size, blocks_tile_size / blocks_tileset_size);
-    obj.glo = std::make_shared<GLObject>(create_gl_object(vertices.data(), vertices.size(), indices.data(), indices.size()));
+    obj.glo = game.geometry_cache->quad(glm::vec2(1.f), blocks_offset.at(block) / blocks_tileset_size, blocks_tile_size / blocks_tileset_size);
     obj.texture = game.block_texture;
-    obj.transform.position.x = i * 0.5f + j * 0.5f - /*canvas offset*/(game.map->tilemap.size() / 2.f);
-    obj.transform.position.y = i * 0.25f - j * 0.25f + k * 0.5f - /*canvas offset*/0.5f;
+    obj.transform.position = block_position(game, p);
     obj.transform.scale = glm::vec2(1.f);
     return obj;
 }
@@ -480,13 +1714,12 @@ GameObject create_book_object(const Game& game, glm::ivec3 p)
     int i = p.x, j = p.y, k = p.z;
     GameObject obj{};
     obj.transform.scale = glm::vec2(0.4f);
-    obj.transform.position.x = i * 0.5f + j * 0.5f - (game.map->tilemap.size() / 2.f) + 0.5f;
+    obj.transform.position.x = i * 0.5f + j * 0.5f - (game.map->tilemap.size.x / 2.f) + 0.5f;
     obj.transform.position.y = i * 0.25f - j * 0.25f + k * 0.5f + 0.3f;
-    obj.texture = std::make_shared<GLTexture>(*load_rgba_texture("mine-book.png"));
+    obj.texture = game.texture_cache->load("mine-book.png");
     constexpr glm::vec2 sprite_size = {467.f, 42};
     constexpr glm::vec2 sprite_frame_size = {31.f, 42.f};
-    auto [vertices, indices] = gen_sprite_quads(5, glm::vec2(sprite_frame_size.x / sprite_frame_size.y, 1.f), glm::vec2(0.f), glm::vec2(5.f, 1.f) * sprite_frame_size / sprite_size);
-    obj.glo = std::make_shared<GLObject>(create_gl_object(vertices.data(), vertices.size(), indices.data(), indices.size()));
+    obj.glo = game.geometry_cache->sprite_quads(5, glm::vec2(sprite_frame_size.x / sprite_frame_size.y, 1.f), glm::vec2(0.f), glm::vec2(5.f, 1.f) * sprite_frame_size / sprite_size);
     float d1 = (float)(std::rand() % 10) / 10.f;
     obj.sprite_animation = SpriteAnimation{
         .freeze = false,
@@ -521,12 +1754,11 @@ GameObject create_player_object(const Game& game, glm::ivec3 p)
     int i = p.x, j = p.y, k = p.z;
     GameObject obj;
     obj.transform.scale = glm::vec2(0.7f);
-    obj.transform.position.x = i * 0.5f + j * 0.5f - (game.map->tilemap.size() / 2.f) + 0.5f;
+    obj.transform.position.x = i * 0.5f + j * 0.5f - (game.map->tilemap.size.x / 2.f) + 0.5f;
     obj.transform.position.y = i * 0.25f - j * 0.25f + k * 0.5f + 0.3f;
-    obj.texture = std::make_shared<GLTexture>(*load_rgba_texture("mine-steve.png"));
+    obj.texture = game.texture_cache->load("mine-steve.png");
     constexpr glm::vec2 sprite_frame_size = {38.f, 72.f};
-    auto [vertices, indices] = gen_sprite_quads(8, glm::vec2(sprite_frame_size.x / sprite_frame_size.y, 1.f), glm::vec2(0.f), glm::vec2(1.f));
-    obj.glo = std::make_shared<GLObject>(create_gl_object(vertices.data(), vertices.size(), indices.data(), indices.size()));
+    obj.glo = game.geometry_cache->sprite_quads(8, glm::vec2(sprite_frame_size.x / sprite_frame_size.y, 1.f), glm::vec2(0.f), glm::vec2(1.f));
     obj.sprite_animation = SpriteAnimation{
       .freeze = true,
       .last_transit_dt = 0,
@@ -545,38 +1777,41 @@ GameObject create_player_object(const Game& game, glm::ivec3 p)
     return obj;
 }
 
-/// Load Main Scene
-Scene load_scene(const Game& game)
+/// Load Main Scene, nullopt if no column of the map has room for the player
+std::optional<Scene> load_scene(const Game& game)
 {
+    ScopeTimer timer("load_scene");
     Scene scene;
     scene.bg_color = glm::vec4(glm::vec3(0x2E, 0x3E, 0x69) / glm::vec3(255.f), 1.0f);
 
-    auto& platform = scene.platform;
-    for (int i = 0; i < (int)game.map->tilemap.size(); i++) {
-        platform.resize(game.map->tilemap.size());
-        for (int j = 0; j < (int)game.map->tilemap[i].size(); j++) {
-            platform[i].resize(game.map->tilemap[i].size());
-            for (int k = 0; k < (int)game.map->tilemap[i][j].size(); k++) {
-                platform[i][j].resize(game.map->tilemap[i][j].size());
-                ObjectType block = game.map->tilemap[i][j][k];
-                if (block == ObjectType::AIR) continue;
-                platform[i][j][k] = create_game_object(game, {i, j, k}, block);
-            }
-        }
-    }
+    // static blocks are drawn straight from the map, only books need entities
+    game.map->tilemap.for_each(ObjectType::BOOK, [&](glm::uvec3 p) {
+        scene.set_object(p, scene.world.spawn(create_book_object(game, p)));
+    });
 
     { // Player
-        // random position
-        int i, j, k = 1;
-        do {
-            i = std::rand() % game.map->size.x;
-            j = std::rand() % game.map->size.y;
-            if (game.map->tilemap[i][j][1] == ObjectType::AIR && game.map->tilemap[i][j][2] == ObjectType::AIR)
+        // random position, standing on the ground with room above.
+        // columns are scanned once from a random start, a full map may have none with room.
+        glm::uvec3 size = game.map->tilemap.size;
+        size_t num_columns = (size_t)size.x * size.y;
+        size_t start = std::rand() % num_columns;
+        int i = 0, j = 0, k = -1;
+        for (size_t n = 0; n < num_columns; n++) {
+            size_t column = (start + n) % num_columns;
+            i = column / size.y;
+            j = column % size.y;
+            k = game.map->tilemap.column_top(i, j) + 1;
+            if (k > 0 && k + 1 < (int)size.z && is_opaque(game.map->tilemap(i, j, k - 1)))
                 break;
-        } while(1);
+            k = -1;
+        }
+        if (k < 0) {
+            fprintf(stderr, "No room for the player in the map\n");
+            return std::nullopt;
+        }
         // create player object
         scene.player_idx = glm::vec3(i, j, k);
-        platform[i][j][k] = create_player_object(game, {i, j, k});
+        scene.set_object(scene.player_idx, scene.world.spawn(create_player_object(game, {i, j, k})));
     }
 
     return scene;
@@ -586,15 +1821,21 @@ Scene load_scene(const Game& game)
 void drop_tile_block(Game& game, float dt, float time)
 {
     do {
-        int i = std::rand() % game.map->size.x;
-        int j = std::rand() % game.map->size.y;
-        if (game.map->tilemap[i][j][1] == ObjectType::BOOK || glm::uvec3(i, j, 1) == game.scene->player_idx) {
+        int i = std::rand() % game.map->tilemap.size.x;
+        int j = std::rand() % game.map->tilemap.size.y;
+        int top = game.map->tilemap.column_top(i, j);
+        if ((top >= 0 && game.map->tilemap(i, j, top) == ObjectType::BOOK) || glm::uvec2(i, j) == glm::uvec2(game.scene->player_idx)) {
           continue;
         }
-        auto& platform = game.scene->platform;
-        for (size_t k = 0; k < game.map->size.z; k++) {
-            if (platform[i][j][k].glo)
-                platform[i][j][k].gravity = Gravity{};
+        // blocks of the column leave the map and become falling entities
+        for (int k = top; k >= 0; k--) {
+            glm::uvec3 p(i, j, k);
+            ObjectType block = game.map->tilemap.get(p);
+            if (!is_opaque(block)) continue;
+            GameObject obj = create_block_object(game, p, block);
+            obj.gravity = Gravity{};
+            game.scene->set_object(p, game.scene->world.spawn(std::move(obj)));
+            game.map->set(p, ObjectType::AIR);
         }
         break;
     } while(1);
@@ -612,17 +1853,36 @@ int game_init(Game& game, GLFWwindow* window)
     game.viewport.offset = glm::uvec2(0);
     game.cursor = glm::vec2(0.f);
     game.zoom = 1.0f;
-    game.shader_program = load_shader_program();
-    auto [quad_vertices, quad_indices] = gen_quad_geometry(glm::vec2(1.f), glm::vec2(0.f), glm::vec2((float)WIDTH / (float)HEIGHT, 1.0f));
-    game.canvas_quad_glo = std::make_shared<GLObject>(create_gl_object(quad_vertices.data(), quad_vertices.size(), quad_indices.data(), quad_indices.size()));
-    game.white_texture = std::make_shared<GLTexture>(*load_rgba_texture("white.png"));
-    game.black_texture = std::make_shared<GLTexture>(*load_rgba_texture("black.png"));
-    game.block_texture = std::make_shared<GLTexture>(*load_rgba_texture("mine-blocks.png"));
+    if (!g_headless) {
+        game.shader_program = load_shader_program();
+        game.camera_ubo = CameraUniformBuffer::create();
+    }
+    game.geometry_cache = std::make_shared<GeometryCache>();
+    game.texture_cache = std::make_shared<TextureCache>();
+    game.canvas_quad_glo = game.geometry_cache->quad(glm::vec2(1.f), glm::vec2(0.f), glm::vec2((float)WIDTH / (float)HEIGHT, 1.0f));
+    game.white_texture = game.texture_cache->load("white.png");
+    game.black_texture = game.texture_cache->load("black.png");
+    game.block_texture = game.texture_cache->load("mine-blocks.png");
+    for (auto& [block, offset] : blocks_offset) {
+        game.block_glos[block] = game.geometry_cache->quad(glm::vec2(1.f), offset / blocks_tileset_size, blocks_tile_size / blocks_tileset_size);
+        game.block_texoffsets[block] = offset / blocks_tileset_size;
+    }
+    if (!g_headless) {
+        GLObjectRef quad = game.geometry_cache->quad(glm::vec2(1.f), glm::vec2(0.f), blocks_tile_size / blocks_tileset_size);
+        game.block_batch = BlockBatch::create(std::move(quad), *game.block_texture, game.shader_program.id);
+    }
     game.camera = Camera::create(game.viewport.aspect_ratio(), 1.f);
-    game.map = load_map(game);
-    game.scene = load_scene(game);
+    game.map = g_world_path.empty() ? std::nullopt : load_world_file(g_world_path);
+    if (game.map) game.scene = load_scene(game);
+    if (!game.scene) {
+        game.map = load_map(game);
+        game.scene = load_scene(game);
+        if (!game.scene) return -1;
+    }
     game.key_states = KeyStateMap(GLFW_KEY_LAST);
     game.books_collected_count = 0;
+    game.books_total_count = 0;
+    game.map->tilemap.for_each(ObjectType::BOOK, [&](glm::uvec3) { game.books_total_count++; });
     game.debug_triangles = false;
     game.target_objtype = ObjectType::STONE;
     game.target_obj = create_block_object(game, glm::ivec3(0), ObjectType::STONE);
@@ -644,11 +1904,11 @@ int game_init(Game& game, GLFWwindow* window)
         .action =
             [](Game &game, auto &&...) {
                 if (game.mode != GameMode::COLLECT_BOOKS) return;
-                if (game.books_collected_count == 10) {
+                if (game.books_collected_count == game.books_total_count) {
                     std::cout << "YOU WIN" << std::endl;
                     game.over = true;
                 }
-                else if (game.scene->player().gravity) {
+                else if (game.scene->world.gravities.has(game.scene->player())) {
                     std::cout << "GAME OVER" << std::endl;
                     game.over = true;
                 }
@@ -662,11 +1922,22 @@ int game_init(Game& game, GLFWwindow* window)
 
 void game_restart(Game& game, GameMode mode)
 {
-    game.over = false;
+    GameMode prev_mode = game.mode;
+    std::optional<Map> prev_map = std::move(game.map);
     game.mode = mode;
     game.map = load_map(game);
-    game.scene = load_scene(game);
+    std::optional<Scene> scene = load_scene(game);
+    if (!scene) {
+        // keep playing the current game
+        game.mode = prev_mode;
+        game.map = std::move(prev_map);
+        return;
+    }
+    game.over = false;
+    game.scene = std::move(scene);
     game.books_collected_count = 0;
+    game.books_total_count = 0;
+    game.map->tilemap.for_each(ObjectType::BOOK, [&](glm::uvec3) { game.books_total_count++; });
 
     std::cout << "GAME RESTART: Mode "
         << (mode == GameMode::CREATIVE ? "CREATIVE" : "COLLECT_BOOKS")
@@ -676,6 +1947,7 @@ void game_restart(Game& game, GameMode mode)
 /// Game tick update
 void game_update(Game& game, float dt, float time)
 {
+    ScopeTimer timer("game_update");
     if (game.over) return;
 
     // Run timed actions
@@ -683,24 +1955,49 @@ void game_update(Game& game, float dt, float time)
         timed_action.update(game, dt, time);
     }
 
-    // Update all objects
-    for (int i = game.map->size.x-1; i >=0 ; i--) {
-        for (int j = 0; j < (int)game.map->size.y; j++) {
-            for (int k = 0; k < (int)game.map->size.z; k++) {
-                auto* obj = &game.scene->platform[i][j][k];
-                // Gravity system
-                if (obj->gravity) {
-                    constexpr float kGravityFactor = 10.f;
-                    obj->motion.acceleration.y = -kGravityFactor;
-                }
-                // Motion system
-                obj->motion.velocity += obj->motion.acceleration * dt;
-                obj->transform.position += obj->motion.velocity * dt;
-                // Sprite Animation system
-                if (obj->sprite_animation) {
-                    obj->sprite_animation->update_frame(dt);
-                }
-            }
+    World& world = game.scene->world;
+
+    // Gravity system
+    {
+        ScopeTimer timer("Gravity system");
+        for (Entity e : world.actives.entities) {
+            constexpr float kGravityFactor = 10.f;
+            if (world.gravities.has(e))
+                world.motions[e].acceleration.y = -kGravityFactor;
+        }
+    }
+
+    // Motion system
+    {
+        ScopeTimer timer("Motion system");
+        for (Entity e : world.actives.entities) {
+            Motion* motion = world.motions.get(e);
+            if (!motion) continue;
+            Transform& transform = world.transforms[e];
+            motion->prev_position = transform.position;
+            motion->velocity += motion->acceleration * dt;
+            transform.position += motion->velocity * dt;
+        }
+    }
+
+    // Sprite Animation system
+    {
+        ScopeTimer timer("Sprite Animation system");
+        for (Entity e : world.actives.entities) {
+            if (SpriteAnimation* sprite_animation = world.sprite_animations.get(e))
+                sprite_animation->update_frame(dt);
+        }
+    }
+
+    // Settle system, falling entities leave the active set once they are far below the map
+    {
+        ScopeTimer timer("Settle system");
+        float settle_y = -(game.map->tilemap.size.y * 0.25f) - kSettleDepth;
+        // backwards, as settling moves the last active entity into the current slot
+        for (size_t i = world.actives.size(); i-- > 0;) {
+            Entity e = world.actives.entities[i];
+            if (world.gravities.has(e) && world.transforms[e].position.y < settle_y)
+                world.settle(e);
         }
     }
 
@@ -718,19 +2015,21 @@ void begin_render(Game& game)
     glClear(GL_COLOR_BUFFER_BIT);
 }
 
-/// Upload camera matrix to shader
-void set_camera(const GLuint shader, const Camera& camera)
+/// Upload camera matrices to the shared camera uniform buffer
+void set_camera(const CameraUniformBuffer& camera_ubo, const Camera& camera)
 {
-    glUniformMatrix4fv(glGetUniformLocation(shader, "view"), 1, GL_FALSE, glm::value_ptr(camera.view));
-    glUniformMatrix4fv(glGetUniformLocation(shader, "projection"), 1, GL_FALSE, glm::value_ptr(camera.projection));
+    glBindBuffer(GL_UNIFORM_BUFFER, camera_ubo.ubo);
+    glBufferSubData(GL_UNIFORM_BUFFER, 0 * sizeof(glm::mat4), sizeof(glm::mat4), glm::value_ptr(camera.view));
+    glBufferSubData(GL_UNIFORM_BUFFER, 1 * sizeof(glm::mat4), sizeof(glm::mat4), glm::value_ptr(camera.projection));
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
 }
 
 /// Render a textured GLObject
-void draw_object(const GLuint shader, const GLTexture& texture, const GLObject& glo, const glm::mat4& model,
+void draw_object(const ShaderProgram& shader, const GLTexture& texture, const GLObject& glo, const glm::mat4& model,
                  const std::optional<SpriteFrame> sprite, const glm::vec4 color = glm::vec4(1.f))
 {
-    glUniformMatrix4fv(glGetUniformLocation(shader, "model"), 1, GL_FALSE, glm::value_ptr(model));
-    glUniform4fv(glGetUniformLocation(shader, "color"), 1, glm::value_ptr(color));
+    glUniformMatrix4fv(shader.model, 1, GL_FALSE, glm::value_ptr(model));
+    glUniform4fv(shader.color, 1, glm::value_ptr(color));
     glActiveTexture(GL_TEXTURE0);
     glBindTexture(GL_TEXTURE_2D, texture);
     glBindVertexArray(glo.vao);
@@ -739,86 +2038,165 @@ void draw_object(const GLuint shader, const GLTexture& texture, const GLObject&
     glDrawElements(GL_TRIANGLES, ebo_count, GL_UNSIGNED_SHORT, (const void*)ebo_offset);
 }
 
-/// Render triangles for all objects
-void render_triangles(Game& game, GLuint shader)
+/// Visit every cell holding a visible block or an entity, in draw order, back to front.
+/// Only cells whose block can overlap the camera view are walked. Block quads cover [x, x+1] x [y, y+1] with
+/// x = (i+j)/2 - size.x/2 and y = (i-j)/4 + k/2 - 1/2, see block_position, which inverted gives the visible
+/// range of i+j, and for each column the visible range of k.
+template<typename F>
+void for_each_cell_in_draw_order(Game& game, F&& fn)
 {
-    glLineWidth(1.0f);
-    glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
-    for (int i = game.map->size.x-1; i >=0 ; i--) {
-        for (int j = 0; j < (int)game.map->size.y; j++) {
-            for (int k = 0; k < (int)game.map->size.z; k++) {
-                auto* obj = &game.scene->platform[i][j][k];
-                if (obj->glo) {
-                    glBindVertexArray(obj->glo->vao);
-                    Transform transform = obj->transform;
-                    draw_object(shader, *game.black_texture, *obj->glo, transform.matrix(), std::nullopt);
+    ScopeTimer timer("for_each_cell_in_draw_order");
+    const ChunkedGrid<ObjectType>& tilemap = game.map->tilemap;
+    const ChunkedGrid<uint8_t>& visible = game.map->visible;
+    const World& world = game.scene->world;
+    const auto& objects = game.scene->objects;
+    const glm::ivec3 size = tilemap.size;
+    const glm::vec4 rect = game.camera->view_rect();
+
+    // i+j from the horizontal extent, i-j from the vertical extent over all layers
+    float x_offset = size.x / 2.f;
+    int sum_min = std::ceil(2.f * (rect.x - 1.f + x_offset));
+    int sum_max = std::floor(2.f * (rect.z + x_offset));
+    int diff_min = std::ceil(4.f * (rect.y - 0.5f - (size.z - 1) * 0.5f));
+    int diff_max = std::floor(4.f * (rect.w + 0.5f));
+    int i_min = std::max(0, (int)std::ceil((sum_min + diff_min) / 2.f));
+    int i_max = std::min(size.x - 1, (int)std::floor((sum_max + diff_max) / 2.f));
+
+    // entities of cells out of the walked range are visited on their own, as they may have moved into view
+    auto object = objects.begin();
+    auto visit_objects_before = [&](uint64_t key) {
+        for (; object != objects.end() && object->first < key; ++object) {
+            glm::vec2 position = world.transforms[object->second].position;
+            if (position.x >= rect.x - 1.f && position.x <= rect.z && position.y >= rect.y - 1.f && position.y <= rect.w)
+                fn(Scene::draw_cell(object->first), ObjectType::AIR, object->second);
+        }
+    };
+
+    for (int i = i_max; i >= i_min; i--) {
+        int j_min = std::max({0, sum_min - i, i - diff_max});
+        int j_max = std::min({size.y - 1, sum_max - i, i - diff_min});
+        for (int j = j_min; j <= j_max; j++) {
+            float y_base = (i - j) * 0.25f - 0.5f;
+            int k_min = std::max(0, (int)std::ceil(2.f * (rect.y - 1.f - y_base)));
+            int k_max = std::min(size.z - 1, (int)std::floor(2.f * (rect.w - y_base)));
+            if (k_min > k_max) continue;
+            visit_objects_before(Scene::draw_key(glm::uvec3(i, j, k_min)));
+            // stop the column above both its top block and its last entity
+            int top = game.map->visible_top(i, j);
+            uint64_t column_end = Scene::draw_key(glm::uvec3(i, j, k_max));
+            const PaletteChunk<ObjectType>* chunk = nullptr;
+            const PaletteChunk<uint8_t>* visible_chunk = nullptr;
+            for (int k = k_min; k <= k_max; k++) {
+                bool has_object = (object != objects.end() && object->first <= column_end);
+                if (k > top && !has_object) break;
+                glm::uvec3 p(i, j, k);
+                if (k == k_min || k % kChunkSize == 0) {
+                    visible_chunk = (k <= top) ? visible.find_chunk(p) : nullptr;
+                    chunk = visible_chunk ? tilemap.find_chunk(p) : nullptr;
                 }
+                uint32_t idx = PaletteChunk<ObjectType>::index(p % kChunkSize);
+                bool is_visible = visible_chunk && visible_chunk->get(idx);
+                ObjectType block = is_visible ? chunk->get(idx) : ObjectType::AIR;
+                Entity e = kNullEntity;
+                if (has_object && object->first == Scene::draw_key(p))
+                    e = (object++)->second;
+                if (block != ObjectType::AIR || e != kNullEntity)
+                    fn(p, block, e);
             }
         }
     }
+    visit_objects_before(UINT64_MAX);
+}
+
+/// Model matrix of the static block at a map cell
+glm::mat4 block_matrix(const Game& game, glm::uvec3 p)
+{
+    return glm::translate(glm::mat4(1.0f), glm::vec3(block_position(game, p), 0.f));
+}
+
+/// Render triangles for all objects
+void render_triangles(Game& game, const ShaderProgram& shader, float alpha)
+{
+    glLineWidth(1.0f);
+    glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
+    World& world = game.scene->world;
+    for_each_cell_in_draw_order(game, [&](glm::uvec3 p, ObjectType block, Entity e) {
+        if (const GLObjectRef& glo = game.block_glos[block])
+            draw_object(shader, *game.black_texture, *glo, block_matrix(game, p), std::nullopt);
+        if (Mesh* mesh = world.meshes.get(e))
+            draw_object(shader, *game.black_texture, *mesh->glo, world.interpolated(e, alpha).matrix(), std::nullopt);
+    });
 
     glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
 }
 
 
 /// Render surface of tiles
-void render_surface(Game& game, GLuint shader)
+void render_surface(Game& game, const ShaderProgram& shader, float alpha)
 {
     glLineWidth(1.0f);
     glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
 
     float h/*height_normal*/ = tile_surface_height / blocks_tile_size.y;
-    std::array<Vertex, 4> vertices = {
-        Vertex{.pos = { 0.0f,  0.5f * h }, .texcoord = { 0.0f, 0.5f }},
-        Vertex{.pos = { 0.5f,  0.0f     }, .texcoord = { 0.5f, 0.0f }},
-        Vertex{.pos = { 1.0f,  0.5f * h }, .texcoord = { 1.0f, 0.5f }},
-        Vertex{.pos = { 0.5f,  1.0f * h }, .texcoord = { 0.5f, 1.0f }},
-    };
-    std::array<GLushort, 6> indices = {
-        0, 1, 3,
-        1, 3, 2
-    };
-    GLObject glo = create_gl_object(vertices.data(), vertices.size(), indices.data(), indices.size(), GL_STREAM_DRAW);
-    glBindVertexArray(glo.vao);
-    for (int i = game.map->size.x-1; i >=0 ; i--) {
-        for (int j = 0; j < (int)game.map->size.y; j++) {
-            for (int k = 0; k < (int)game.map->size.z; k++) {
-                auto* obj = &game.scene->platform[i][j][k];
-                if (obj->glo) {
-                    Transform transform = obj->transform;
-                    transform.position.y += 1.f - h;
-                    draw_object(shader, *game.black_texture, glo, transform.matrix(), std::nullopt);
-                }
-            }
-        }
+    if (!game.surface_quad_glo) {
+        std::array<Vertex, 4> vertices = {
+            Vertex{.pos = { 0.0f,  0.5f * h }, .texcoord = { 0.0f, 0.5f }},
+            Vertex{.pos = { 0.5f,  0.0f     }, .texcoord = { 0.5f, 0.0f }},
+            Vertex{.pos = { 1.0f,  0.5f * h }, .texcoord = { 1.0f, 0.5f }},
+            Vertex{.pos = { 0.5f,  1.0f * h }, .texcoord = { 0.5f, 1.0f }},
+        };
+        std::array<GLushort, 6> indices = {
+            0, 1, 3,
+            1, 3, 2
+        };
+        game.surface_quad_glo = make_gl_object_ref(create_gl_object(vertices.data(), vertices.size(), indices.data(), indices.size()));
     }
+    const GLObject& glo = *game.surface_quad_glo;
+    glBindVertexArray(glo.vao);
+    World& world = game.scene->world;
+    for_each_cell_in_draw_order(game, [&](glm::uvec3 p, ObjectType block, Entity e) {
+        glm::vec2 position;
+        if (game.block_glos[block])
+            position = block_position(game, p);
+        else if (world.meshes.has(e))
+            position = world.interpolated(e, alpha).position;
+        else
+            return;
+        position.y += 1.f - h;
+        draw_object(shader, *game.black_texture, glo, glm::translate(glm::mat4(1.0f), glm::vec3(position, 0.f)), std::nullopt);
+    });
     glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
 }
 
-/// Render Game scene
-void game_render(Game& game)
+/// Render Game scene, alpha is the fraction of a tick elapsed since the last game_update
+void game_render(Game& game, float alpha)
 {
+    ScopeTimer timer("game_render");
     begin_render(game);
-    GLuint shader = game.shader_program;
-    glUseProgram(shader);
-    set_camera(shader, *game.camera);
-
-    for (int i = game.map->size.x-1; i >=0 ; i--) {
-        for (int j = 0; j < (int)game.map->size.y; j++) {
-            for (int k = 0; k < (int)game.map->size.z; k++) {
-                auto* obj = &game.scene->platform[i][j][k];
-                if (obj->glo && obj->texture) {
-                    //transperency
-                    //auto color = (k > 0 && glm::uvec3(i, j, k) != game.scene->player_idx) ? glm::vec4(glm::vec3(1.0f), 0.6f) : glm::vec4(1.f);
-                    auto color = glm::vec4(1.f);
-                    if (obj->highlight)
-                        color = glm::vec4(glm::vec3(0.65f), 1.f);
-                    auto sprite = obj->sprite_animation ? std::make_optional<SpriteFrame>(obj->sprite_animation->curr_frame()) : std::nullopt;
-                    draw_object(shader, *obj->texture, *obj->glo, obj->transform.matrix(), sprite, color);
-                }
-            }
+    const ShaderProgram& shader = game.shader_program;
+    glUseProgram(shader.id);
+    set_camera(*game.camera_ubo, *game.camera);
+
+    // blocks are batched into instanced draws, interrupted only by the entities between them
+    BlockBatch& batch = *game.block_batch;
+    batch.num_draws = 0;
+    World& world = game.scene->world;
+    for_each_cell_in_draw_order(game, [&](glm::uvec3 p, ObjectType block, Entity e) {
+        //transperency
+        //auto color = (p.z > 0 && p != game.scene->player_idx) ? glm::vec4(glm::vec3(1.0f), 0.6f) : glm::vec4(1.f);
+        auto color = glm::vec4(1.f);
+        if (game.scene->highlight_idx == p)
+            color = glm::vec4(glm::vec3(0.65f), 1.f);
+        if (game.block_glos[block])
+            batch.push(BlockInstance{ block_position(game, p), game.block_texoffsets[block], color });
+        if (Mesh* mesh = world.meshes.get(e)) {
+            batch.flush();
+            SpriteAnimation* sprite_animation = world.sprite_animations.get(e);
+            auto sprite = sprite_animation ? std::make_optional<SpriteFrame>(sprite_animation->curr_frame()) : std::nullopt;
+            draw_object(shader, *mesh->texture, *mesh->glo, world.interpolated(e, alpha).matrix(), sprite, color);
         }
-    }
+    });
+    batch.flush();
 
     if (game.mode == GameMode::CREATIVE) {
         GameObject& obj = game.target_obj;
@@ -827,10 +2205,11 @@ void game_render(Game& game)
     }
 
     if (game.debug_triangles)
-        render_surface(game, shader);
+        render_surface(game, shader, alpha);
 }
 
-/// Game Loop, only returns when game finishes
+/// Game Loop, only returns when game finishes.
+/// The simulation runs in fixed ticks, decoupled from the render frame rate.
 int game_loop(GLFWwindow* window)
 {
     Game game;
@@ -838,94 +2217,120 @@ int game_loop(GLFWwindow* window)
     if (ret) return ret;
     glfwSetWindowUserPointer(window, &game);
     float last_time = glfwGetTime();
+    float sim_time = 0.f;
+    float accumulator = 0.f;
     while (!glfwWindowShouldClose(window)) {
         float now_time = glfwGetTime();
-        float dt = now_time - last_time;
+        accumulator += std::min(now_time - last_time, kMaxFrameTime);
         last_time = now_time;
         glfwPollEvents();
-        game_update(game, dt, now_time);
-        game_render(game);
+        while (accumulator >= kTickDuration) {
+            sim_time += kTickDuration;
+            game_update(game, kTickDuration, sim_time);
+            accumulator -= kTickDuration;
+        }
+        game.map->flush();
+        game_render(game, accumulator / kTickDuration);
+        ScopeTimer timer("glfwSwapBuffers");
         glfwSwapBuffers(window);
     }
     glfwSetWindowUserPointer(window, NULL);
+    Profiler::instance().dump(kProfileTracePath);
+    return 0;
+}
+
+/// Headless Loop, runs the simulation for a number of ticks as fast as possible, without rendering
+int headless_loop(size_t num_ticks)
+{
+    Game game;
+    int ret = game_init(game, nullptr);
+    if (ret) return ret;
+    auto start_time = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < num_ticks; i++) {
+        // keep simulating past the end of a round
+        if (game.over) game_restart(game, game.mode);
+        game_update(game, kTickDuration, (i + 1) * kTickDuration);
+        game.map->flush();
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start_time;
+    printf("Headless: %zu ticks in %.3f s, %.0f ticks/s\n", num_ticks, elapsed.count(), num_ticks / elapsed.count());
+    const ChunkedGrid<ObjectType>& tilemap = game.map->tilemap;
+    printf("Map: %ux%ux%u cells, %zu chunks, %.1f MB\n", tilemap.size.x, tilemap.size.y, tilemap.size.z,
+           tilemap.chunks.size(), tilemap.memory_usage() / (1024.f * 1024.f));
+    if (!g_world_path.empty() && save_world_file(*game.map, g_world_path))
+        printf("World saved to %s\n", g_world_path.c_str());
+    Profiler::instance().dump(kProfileTracePath);
     return 0;
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 /// Events
 
+/// Move the player to a neighbour cell if it's free, or holds a book to collect
+void try_move_player(Game& game, glm::ivec3 to)
+{
+    Scene& scene = *game.scene;
+    World& world = scene.world;
+    // walk along the ground, one block up or down at most, keeping the height over holes so the player falls
+    for (int ground = std::min<int>(to.z + 1, game.map->tilemap.size.z - 1); ground >= 0; ground--) {
+        if (!is_opaque(game.map->tilemap(to.x, to.y, ground))) continue;
+        if (ground + 1 < to.z - 1 || ground + 1 > to.z + 1) return;
+        to.z = ground + 1;
+        break;
+    }
+    if (to.z + 1 >= (int)game.map->tilemap.size.z) return;
+    int i = to.x, j = to.y, k = to.z;
+    auto is_free = [&](glm::uvec3 p) {
+        return game.map->tilemap.get(p) == ObjectType::AIR && scene.object_at(p) == kNullEntity;
+    };
+    bool is_book = (game.mode == GameMode::COLLECT_BOOKS && game.map->tilemap(i, j, k) == ObjectType::BOOK);
+    if (!(is_free(to) && is_free(glm::uvec3(i, j, k+1))) && !is_book)
+        return;
+    if (is_book) {
+        world.destroy(scene.object_at(to));
+        game.map->set(to, ObjectType::AIR);
+        game.books_collected_count++;
+    }
+    Entity player = scene.player();
+    scene.set_object(scene.player_idx, kNullEntity);
+    scene.set_object(to, player);
+    scene.player_idx = to;
+    Transform& transform = world.transforms[player];
+    transform.position.x = i * 0.5f + j * 0.5f - (game.map->tilemap.size.x / 2.f) + 0.5f;
+    transform.position.y = i * 0.25f - j * 0.25f + k * 0.5f + 0.3f;
+    if (world.gravities.has(scene.object_at(glm::uvec3(i, j, 0)))) { world.add_gravity(player); }
+}
+
 void key_arrows_handler(struct Game& game, int key, int action, int mods)
 {
-    if (game.scene->player().gravity) return;
+    World& world = game.scene->world;
+    const Entity player = game.scene->player();
+    if (world.gravities.has(player)) return;
 
     if (action == GLFW_PRESS) {
         if (key == GLFW_KEY_UP) {
             int i = game.scene->player_idx.x + 1, j = game.scene->player_idx.y, k = game.scene->player_idx.z;
-            game.scene->platform[i-1][j][k].sprite_animation->curr_frame_idx = 3;
-            if (i < (int)game.map->size.x ) {
-                if ((!game.scene->platform[i][j][k].glo && !game.scene->platform[i][j][k+1].glo) || (game.mode == GameMode::COLLECT_BOOKS && game.map->tilemap[i][j][k] == ObjectType::BOOK)) {
-                    game.scene->player_idx.x = i;
-                    auto& obj = game.scene->platform[i][j][k] = std::move(game.scene->platform[i-1][j][k]);
-                    obj.transform.position.x = i * 0.5f + j * 0.5f - (game.map->tilemap.size() / 2.f) + 0.5f;
-                    obj.transform.position.y = i * 0.25f - j * 0.25f + k * 0.5f + 0.3f;
-                    if (game.scene->platform[i][j][0].gravity) { obj.gravity = Gravity{}; }
-                    if (game.mode == GameMode::COLLECT_BOOKS && game.map->tilemap[i][j][k] == ObjectType::BOOK) {
-                        game.map->tilemap[i][j][k] = ObjectType::AIR;
-                        game.books_collected_count++;
-                    }
-                }
-            }
+            world.sprite_animations[player].curr_frame_idx = 3;
+            if (i < (int)game.map->tilemap.size.x)
+                try_move_player(game, {i, j, k});
         }
         else if (key == GLFW_KEY_DOWN) {
             int i = game.scene->player_idx.x - 1, j = game.scene->player_idx.y, k = game.scene->player_idx.z;
-            game.scene->platform[i+1][j][k].sprite_animation->curr_frame_idx = 1;
-            if (i >= 0) {
-                if ((!game.scene->platform[i][j][k].glo && !game.scene->platform[i][j][k+1].glo) || (game.mode == GameMode::COLLECT_BOOKS && game.map->tilemap[i][j][k] == ObjectType::BOOK)) {
-                    game.scene->player_idx.x = i;
-                    auto& obj = game.scene->platform[i][j][k] = std::move(game.scene->platform[i+1][j][k]);
-                    obj.transform.position.x = i * 0.5f + j * 0.5f - (game.map->tilemap.size() / 2.f) + 0.5f;
-                    obj.transform.position.y = i * 0.25f - j * 0.25f + k * 0.5f + 0.3f;
-                    if (game.scene->platform[i][j][0].gravity) { obj.gravity = Gravity{}; }
-                    if (game.mode == GameMode::COLLECT_BOOKS && game.map->tilemap[i][j][k] == ObjectType::BOOK) {
-                        game.map->tilemap[i][j][k] = ObjectType::AIR;
-                        game.books_collected_count++;
-                    }
-                }
-            }
+            world.sprite_animations[player].curr_frame_idx = 1;
+            if (i >= 0)
+                try_move_player(game, {i, j, k});
         }
         else if (key == GLFW_KEY_RIGHT) {
             int i = game.scene->player_idx.x, j = game.scene->player_idx.y + 1, k = game.scene->player_idx.z;
-            game.scene->platform[i][j-1][k].sprite_animation->curr_frame_idx = 0;
-            if (j < (int)game.map->size.y) {
-                if ((!game.scene->platform[i][j][k].glo && !game.scene->platform[i][j][k+1].glo) || (game.mode == GameMode::COLLECT_BOOKS && game.map->tilemap[i][j][k] == ObjectType::BOOK)) {
-                    game.scene->player_idx.y = j;
-                    auto& obj = game.scene->platform[i][j][k] = std::move(game.scene->platform[i][j-1][k]);
-                    obj.transform.position.x = i * 0.5f + j * 0.5f - (game.map->tilemap.size() / 2.f) + 0.5f;
-                    obj.transform.position.y = i * 0.25f - j * 0.25f + k * 0.5f + 0.3f;
-                    if (game.scene->platform[i][j][0].gravity) { obj.gravity = Gravity{}; }
-                    if (game.mode == GameMode::COLLECT_BOOKS && game.map->tilemap[i][j][k] == ObjectType::BOOK) {
-                        game.map->tilemap[i][j][k] = ObjectType::AIR;
-                        game.books_collected_count++;
-                    }
-                }
-            }
+            world.sprite_animations[player].curr_frame_idx = 0;
+            if (j < (int)game.map->tilemap.size.y)
+                try_move_player(game, {i, j, k});
         }
         else if (key == GLFW_KEY_LEFT) {
             int i = game.scene->player_idx.x, j = game.scene->player_idx.y - 1, k = game.scene->player_idx.z;
-            game.scene->platform[i][j+1][k].sprite_animation->curr_frame_idx = 2;
-            if (j >= 0) {
-                if ((!game.scene->platform[i][j][k].glo && !game.scene->platform[i][j][k+1].glo) || (game.mode == GameMode::COLLECT_BOOKS && game.map->tilemap[i][j][k] == ObjectType::BOOK)) {
-                    game.scene->player_idx.y = j;
-                    auto& obj = game.scene->platform[i][j][k] = std::move(game.scene->platform[i][j+1][k]);
-                    obj.transform.position.x = i * 0.5f + j * 0.5f - (game.map->tilemap.size() / 2.f) + 0.5f;
-                    obj.transform.position.y = i * 0.25f - j * 0.25f + k * 0.5f + 0.3f;
-                    if (game.scene->platform[i][j][0].gravity) { obj.gravity = Gravity{}; }
-                    if (game.mode == GameMode::COLLECT_BOOKS && game.map->tilemap[i][j][k] == ObjectType::BOOK) {
-                        game.map->tilemap[i][j][k] = ObjectType::AIR;
-                        game.books_collected_count++;
-                    }
-                }
-            }
+            world.sprite_animations[player].curr_frame_idx = 2;
+            if (j >= 0)
+                try_move_player(game, {i, j, k});
         }
     }
 }
@@ -951,6 +2356,18 @@ void key_f5_handler(struct Game& game, int key, int action, int mods)
     game.debug_triangles = !game.debug_triangles;
 }
 
+void key_f6_handler(struct Game& game, int key, int action, int mods)
+{
+  if (action == GLFW_PRESS && !g_world_path.empty() && save_world_file(*game.map, g_world_path))
+    std::cout << "World saved to " << g_world_path << std::endl;
+}
+
+void key_f8_handler(struct Game& game, int key, int action, int mods)
+{
+  if (action == GLFW_PRESS)
+    Profiler::instance().dump(kProfileTracePath);
+}
+
 /// Handle Key input event
 void key_event_callback(GLFWwindow* window, int key, int scancode, int action, int mods)
 {
@@ -983,12 +2400,75 @@ void key_event_callback(GLFWwindow* window, int key, int scancode, int action, i
     else if (key == GLFW_KEY_F5) {
         key_f5_handler(*game, key, action, mods);
     }
+    else if (key == GLFW_KEY_F6) {
+        key_f6_handler(*game, key, action, mods);
+    }
+    else if (key == GLFW_KEY_F8) {
+        key_f8_handler(*game, key, action, mods);
+    }
 
     game->key_states.value()[key] = (action == GLFW_PRESS);
 }
 
 void cursor_position_callback(GLFWwindow* window, double xpos, double ypos);
 
+/// Canvas position under a cursor position in window coordinates
+glm::vec2 cursor_to_canvas(const Game& game, glm::vec2 cursor)
+{
+    glm::vec2 normal_pos = glm::vec2(cursor.x, game.window.size.y - cursor.y) / glm::vec2(game.window.size);
+    glm::vec4 rect = game.camera->view_rect();
+    return glm::mix(glm::vec2(rect.x, rect.y), glm::vec2(rect.z, rect.w), normal_pos);
+}
+
+/// Height of the top face of a block above its canvas position, which picking aims at
+constexpr float kPickOffsetY = 1.25f - (tile_surface_height / blocks_tile_size.y);
+
+/// Ray of cells under a canvas position, block_position inverted on the top face of the ground layer
+glm::ivec2 canvas_to_ray(const Game& game, glm::vec2 canvas_pos)
+{
+    canvas_pos.y -= kPickOffsetY;
+    float a = canvas_pos.x + 2.f * canvas_pos.y + (game.map->tilemap.size.x / 2.f) + 1.f;
+    float b = a - 4.f * canvas_pos.y - 2.f;
+    return { std::floor(a), std::floor(b) };
+}
+
+/// Invoke fn(cell) with the frontmost block of every ray whose center lies in a canvas rectangle.
+/// Walks only the rays inside the rectangle, with canvas_to_ray solved for b at each a.
+template<typename F>
+void for_each_block_in_canvas_rect(const Game& game, glm::vec2 lo, glm::vec2 hi, F&& fn)
+{
+    const Map& map = *game.map;
+    glm::ivec3 size = map.tilemap.size;
+    lo.y -= kPickOffsetY;
+    hi.y -= kPickOffsetY;
+    float a_offset = size.x / 2.f + 1.f;
+    // with u = x + 2y and v = x - 2y at the ray center: a = u + a_offset - 0.5 and b = v + a_offset - 2.5
+    int a_min = std::max(0, (int)std::ceil(lo.x + 2.f * lo.y + a_offset - 0.5f));
+    int a_max = std::min(size.x + size.z - 2, (int)std::floor(hi.x + 2.f * hi.y + a_offset - 0.5f));
+    for (int a = a_min; a <= a_max; a++) {
+        float u = a + 0.5f - a_offset;
+        float v_min = std::max(2.f * lo.x - u, u - 4.f * hi.y);
+        float v_max = std::min(2.f * hi.x - u, u - 4.f * lo.y);
+        int b_min = std::max(1 - size.z, (int)std::ceil(v_min + a_offset - 2.5f));
+        int b_max = std::min(size.y - 1, (int)std::floor(v_max + a_offset - 2.5f));
+        for (int b = b_min; b <= b_max; b++) {
+            if (std::optional<glm::uvec3> cell = map.pick({a, b}))
+                fn(*cell);
+        }
+    }
+}
+
+/// Remove a block placed in creative mode, along with its entity
+void break_block(Game& game, glm::uvec3 p)
+{
+    game.map->set(p, ObjectType::AIR);
+    Entity e = game.scene->object_at(p);
+    if (e != kNullEntity) {
+        game.scene->world.destroy(e);
+        game.scene->set_object(p, kNullEntity);
+    }
+}
+
 /// Handle Mouse click events
 void mouse_button_callback(GLFWwindow* window, int button, int action, int mods)
 {
@@ -1001,29 +2481,43 @@ void mouse_button_callback(GLFWwindow* window, int button, int action, int mods)
         if (game->scene->highlight_idx) {
             glm::uvec3 s = *game->scene->highlight_idx;
             glm::uvec3 v = s; v.z += 1;
-            if (v != game->scene->player_idx) {
-                auto& block_above = game->map->tilemap[v.x][v.y][v.z];
-                if (block_above == ObjectType::AIR) {
-                    block_above = game->target_objtype;
-                    game->scene->platform[v.x][v.y][v.z] = create_game_object(*game, v, block_above);
+            if (v != game->scene->player_idx && game->map->tilemap.contains(v.x, v.y, v.z)) {
+                if (game->map->tilemap.get(v) == ObjectType::AIR) {
+                    game->map->set(v, game->target_objtype);
+                    if (game->target_objtype == ObjectType::BOOK)
+                        game->scene->set_object(v, game->scene->world.spawn(create_book_object(*game, v)));
                 }
             }
         }
     }
     else if (action == GLFW_PRESS && button == GLFW_MOUSE_BUTTON_LEFT) {
+        game->drag_begin = game->cursor;
         if (game->scene->highlight_idx) {
             glm::uvec3 v = *game->scene->highlight_idx;
             if (v.z != 0) {
-                game->map->tilemap[v.x][v.y][v.z] = ObjectType::AIR;
-                game->scene->platform[v.x][v.y][v.z].highlight = std::nullopt;
-                auto& obj = game->scene->platform[v.x][v.y][v.z];
-                obj.glo = nullptr;
-                double mx, my;
-                glfwGetCursorPos(window, &mx, &my);
-                cursor_position_callback(game->window.glfw, mx, my);
+                break_block(*game, v);
+                game->map->flush();
+                cursor_position_callback(game->window.glfw, game->cursor.x, game->cursor.y);
             }
         }
     }
+    else if (action == GLFW_RELEASE && button == GLFW_MOUSE_BUTTON_LEFT && game->drag_begin) {
+        // dragging a rectangle breaks every block seen inside it
+        constexpr float kMinDragPixels = 8.f;
+        if (glm::length(game->cursor - *game->drag_begin) >= kMinDragPixels) {
+            glm::vec2 p0 = cursor_to_canvas(*game, *game->drag_begin);
+            glm::vec2 p1 = cursor_to_canvas(*game, game->cursor);
+            std::vector<glm::uvec3> cells;
+            for_each_block_in_canvas_rect(*game, glm::min(p0, p1), glm::max(p0, p1), [&](glm::uvec3 p) {
+                if (p.z != 0) cells.push_back(p);
+            });
+            for (glm::uvec3 p : cells)
+                break_block(*game, p);
+            game->map->flush();
+            cursor_position_callback(game->window.glfw, game->cursor.x, game->cursor.y);
+        }
+        game->drag_begin.reset();
+    }
 }
 
 /// Handle cursor movement events
@@ -1035,41 +2529,11 @@ void cursor_position_callback(GLFWwindow* window, double xpos, double ypos)
 
     if (game->mode != GameMode::CREATIVE) return;
 
-    ypos = game->window.size.y - ypos;
-    glm::vec2 cursor_pos{xpos, ypos};
-    glm::vec2 normal_pos = cursor_pos / glm::vec2(game->window.size);
-    glm::vec2 canvas_pos = normal_pos * glm::vec2(game->camera->canvas_size) - glm::vec2(game->camera->canvas_size) / 2.f;
-    canvas_pos *= glm::vec2(game->zoom);
-    canvas_pos.y -= 1.25f - (tile_surface_height / blocks_tile_size.y);
-
-    // cartesian to isometric
-    float i = canvas_pos.x + 2.f * canvas_pos.y + (game->map->size.x / 2.f) + 1.f;
-    float j = i - 4.f * canvas_pos.y - 2.f;
-    float k = 0;
-
-    glm::ivec3 mapsize = game->map->size;
-    if (i >= 0 && i < mapsize.x && j >= 0 && j < mapsize.y && k >= 0 && k < mapsize.z) {
-
-        // check other k layers
-        for (int n = mapsize.z-1; n > 0; n--) {
-            glm::vec3 p = {i - n, j + n, n};
-            if (p.x < 0 || p.y >= mapsize.y || p.z >= mapsize.z)
-                continue;
-            auto& block = game->map->tilemap[p.x][p.y][p.z];
-            if (block != ObjectType::AIR) {
-                i = p.x;
-                j = p.y;
-                k = p.z;
-            }
-        }
-
-        if (game->scene->highlight_idx) {
-            glm::uvec3 v = *game->scene->highlight_idx;
-            game->scene->platform[v.x][v.y][v.z].highlight = std::nullopt;
-        }
-        game->scene->platform[i][j][k].highlight = Highlight{};
-        game->scene->highlight_idx = {i, j, k};
-    }
+    glm::ivec2 ray = canvas_to_ray(*game, cursor_to_canvas(*game, game->cursor));
+    if (std::optional<glm::uvec3> cell = game->map->pick(ray))
+        game->scene->highlight_idx = cell;
+    else if (game->map->tilemap.contains(ray.x, ray.y, 0))
+        game->scene->highlight_idx = glm::uvec3(ray.x, ray.y, 0);
 }
 
 /// Handle Scrool wheel events
@@ -1091,8 +2555,7 @@ void framebuffer_size_callback(GLFWwindow* window, int width, int height)
     glViewport(0, 0, width, height);
     game->camera = Camera::create((float)width / (float)height, game->zoom);
 
-    auto [quad_vertices, quad_indices] = gen_quad_geometry(glm::vec2(1.f), glm::vec2(0.f), glm::vec2((float)width / (float)height, 1.0f));
-    game->canvas_quad_glo = std::make_shared<GLObject>(create_gl_object(quad_vertices.data(), quad_vertices.size(), quad_indices.data(), quad_indices.size()));
+    game->canvas_quad_glo = game->geometry_cache->quad(glm::vec2(1.f), glm::vec2(0.f), glm::vec2((float)width / (float)height, 1.0f));
 
     game->window.size.y = height;
     game->window.size.x = width;
@@ -1145,10 +2608,40 @@ int load_opengl()
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 /// Main
 
-int main()
+int main(int argc, char* argv[])
 {
     int ret;
 
+    // Arguments ==============================================================
+    // usage: [--map-size X Y Z] [--seed N] [--threads N] [--world PATH] [--headless [num_ticks]]
+    size_t num_ticks = 10000;
+    for (int a = 1; a < argc; a++) {
+        if (argv[a] == "--map-size"s && a + 3 < argc) {
+            for (int n = 0; n < 3; n++)
+                g_map_size[n] = std::strtoul(argv[++a], nullptr, 10);
+            // the player needs a ground layer and two free cells above it
+            g_map_size = glm::max(g_map_size, glm::uvec3(1, 1, 3));
+        }
+        else if (argv[a] == "--seed"s && a + 1 < argc) {
+            g_world_seed = std::strtoull(argv[++a], nullptr, 10);
+        }
+        else if (argv[a] == "--threads"s && a + 1 < argc) {
+            g_num_threads = std::max(1ul, std::strtoul(argv[++a], nullptr, 10));
+        }
+        else if (argv[a] == "--world"s && a + 1 < argc) {
+            g_world_path = argv[++a];
+        }
+        else if (argv[a] == "--headless"s) {
+            g_headless = true;
+            if (a + 1 < argc && std::isdigit(argv[a + 1][0]))
+                num_ticks = std::strtoul(argv[++a], nullptr, 10);
+        }
+    }
+
+    // Headless ===============================================================
+    if (g_headless)
+        return headless_loop(num_ticks);
+
     // Create Window ==========================================================
     GLFWwindow* window;
     ret = create_window(window);
@@ -10,6 +10,13 @@
 #include <optional>
 #include <algorithm>
 #include <memory>
+#include <map>
+#include <unordered_map>
+#include <limits>
+#include <chrono>
+#include <mutex>
+#include <cstdint>
+#include <cassert>
 
 #include <GL/glew.h>
 #include <GLFW/glfw3.h>
@@ -29,22 +36,174 @@ using namespace std::string_literals;
 /// Settings
 
 constexpr size_t WIDTH = 900, HEIGHT = 600;
+/// Simulation rate, every game_update advances the game by one fixed tick
+constexpr float kTickRate = 120.f;
+constexpr float kTickDuration = 1.f / kTickRate;
+/// Longest frame time simulated at once, longer hitches slow the game down instead
+constexpr float kMaxFrameTime = 0.25f;
+/// Headless mode runs the simulation without a window nor a GL context,
+/// GL resources are then host-side placeholders with zero ids
+static bool g_headless = false;
+/// File the profile trace is written to, on F8 and at exit
+constexpr const char* kProfileTracePath = "profile-trace.json";
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+/// Profiler
+
+/// Timing of one completed scope
+struct ProfileEvent {
+    const char* name;  // must outlive the profiler, usually a string literal
+    int64_t begin_us;  // microseconds since the profiler started
+    int64_t duration_us;
+};
+
+/// Number of latest events kept per thread
+constexpr size_t kProfileRingSize = 1 << 16;
+
+/// Ring buffer of the latest events recorded by one thread, only written by its owner thread
+struct ProfileRing {
+    uint32_t tid;
+    size_t count = 0;  // number of events ever pushed
+    std::vector<ProfileEvent> events = std::vector<ProfileEvent>(kProfileRingSize);
+
+    void push(const ProfileEvent& event) { events[count++ % kProfileRingSize] = event; }
+};
+
+/// Registry of the ring buffers of all threads
+struct Profiler {
+    std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+    std::mutex mutex;
+    std::vector<std::unique_ptr<ProfileRing>> rings;
+
+    static Profiler& instance() { static Profiler profiler; return profiler; }
+
+    int64_t now_us() const {
+        return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - epoch).count();
+    }
+
+    /// Get the ring buffer of the calling thread, registering it on first use
+    ProfileRing& thread_ring() {
+        thread_local ProfileRing* ring = nullptr;
+        if (!ring) {
+            std::lock_guard lock(mutex);
+            rings.push_back(std::make_unique<ProfileRing>());
+            ring = rings.back().get();
+            ring->tid = rings.size();
+        }
+        return *ring;
+    }
+
+    /// Write all recorded events in Chrome trace format, to be opened in chrome://tracing or Perfetto.
+    /// Call it while no other thread is recording.
+    bool dump(const std::string& filepath) {
+        FILE* file = fopen(filepath.data(), "w");
+        if (!file) {
+            fprintf(stderr, "Failed to write profile trace (%s)\n", filepath.data());
+            return false;
+        }
+        std::lock_guard lock(mutex);
+        fprintf(file, "{\"traceEvents\":[");
+        bool first = true;
+        for (auto& ring : rings) {
+            size_t begin = ring->count > kProfileRingSize ? ring->count - kProfileRingSize : 0;
+            for (size_t i = begin; i < ring->count; i++) {
+                const ProfileEvent& event = ring->events[i % kProfileRingSize];
+                fprintf(file, "%s\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%lld,\"dur\":%lld}",
+                        first ? "" : ",", event.name, ring->tid, (long long)event.begin_us, (long long)event.duration_us);
+                first = false;
+            }
+        }
+        fprintf(file, "\n]}\n");
+        fclose(file);
+        printf("Profile trace written to %s\n", filepath.data());
+        return true;
+    }
+};
+
+/// Records the time spent in the enclosing scope into the profiler
+struct ScopeTimer {
+    const char* name;
+    int64_t begin_us;
+
+    explicit ScopeTimer(const char* name) : name(name), begin_us(Profiler::instance().now_us()) {}
+    ~ScopeTimer() {
+        Profiler& profiler = Profiler::instance();
+        profiler.thread_ring().push({ name, begin_us, profiler.now_us() - begin_us });
+    }
+    ScopeTimer(const ScopeTimer&) = delete;
+    ScopeTimer& operator=(const ScopeTimer&) = delete;
+};
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 /// Shader
 
+/// Uniform block binding point of the Camera block, shared by all shader programs
+constexpr GLuint kCameraUniformBinding = 0;
+
+/// Shader program with its uniform locations resolved at link time
+struct ShaderProgram {
+    GLuint id;
+    GLint model;
+    GLint texoffset;
+};
+
+/// Compile and link a shader program from source, binding its Camera block if present
+GLuint build_shader_program(const char* vertex_shader, const char* fragment_shader)
+{
+    GLint status;
+    GLchar info_log[512];
+
+    GLuint vs = glCreateShader(GL_VERTEX_SHADER);
+    glShaderSource(vs, 1, &vertex_shader, NULL);
+    glCompileShader(vs);
+    glGetShaderiv(vs, GL_COMPILE_STATUS, &status);
+    if (!status) {
+        glGetShaderInfoLog(vs, sizeof(info_log), NULL, info_log);
+        fprintf(stderr, "Failed to compile vertex shader: %s\n", info_log);
+    }
+
+    GLuint fs = glCreateShader(GL_FRAGMENT_SHADER);
+    glShaderSource(fs, 1, &fragment_shader, NULL);
+    glCompileShader(fs);
+    glGetShaderiv(fs, GL_COMPILE_STATUS, &status);
+    if (!status) {
+        glGetShaderInfoLog(fs, sizeof(info_log), NULL, info_log);
+        fprintf(stderr, "Failed to compile fragment shader: %s\n", info_log);
+    }
+
+    GLuint sp = glCreateProgram();
+    glAttachShader(sp, fs);
+    glAttachShader(sp, vs);
+    glLinkProgram(sp);
+    glGetProgramiv(sp, GL_LINK_STATUS, &status);
+    if (!status) {
+        glGetProgramInfoLog(sp, sizeof(info_log), NULL, info_log);
+        fprintf(stderr, "Failed to link shader program: %s\n", info_log);
+    }
+    glDeleteShader(vs);
+    glDeleteShader(fs);
+
+    GLuint camera_block = glGetUniformBlockIndex(sp, "Camera");
+    if (camera_block != GL_INVALID_INDEX)
+        glUniformBlockBinding(sp, camera_block, kCameraUniformBinding);
+    return sp;
+}
+
 /// Compile and link shader program
-GLuint load_shader_program()
+ShaderProgram load_shader_program()
 {
     const char* vertex_shader = R"(
 #version 410
 layout ( location = 0 ) in vec2 vPosition;
 layout ( location = 1 ) in vec2 vTexCoord;
-uniform mat4 projection;
+layout ( std140 ) uniform Camera {
+    mat4 view;
+    mat4 projection;
+};
 uniform mat4 model;
 out vec2 texcoord;
 void main() {
-    gl_Position = projection * model * vec4 (vPosition, 0.0, 1.0f);
+    gl_Position = projection * view * model * vec4 (vPosition, 0.0, 1.0f);
     texcoord = vTexCoord;
 }
 )";
@@ -60,20 +219,13 @@ void main(){
 }
 )";
 
-    GLuint vs = glCreateShader(GL_VERTEX_SHADER);
-    glShaderSource(vs, 1, &vertex_shader, NULL);
-    glCompileShader(vs);
-
-    GLuint fs = glCreateShader(GL_FRAGMENT_SHADER);
-    glShaderSource(fs, 1, &fragment_shader, NULL);
-    glCompileShader(fs);
-
-    GLuint sp = glCreateProgram();
-    glAttachShader(sp, fs);
-    glAttachShader(sp, vs);
-    glLinkProgram(sp);
-    return sp;
-    }
+    GLuint sp = build_shader_program(vertex_shader, fragment_shader);
+    return ShaderProgram{
+        .id = sp,
+        .model = glGetUniformLocation(sp, "model"),
+        .texoffset = glGetUniformLocation(sp, "texoffset"),
+    };
+}
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 /// GLObject
@@ -91,6 +243,8 @@ struct GLObject {
     GLuint ebo;
     size_t num_vertices;
     size_t num_indices;
+    std::vector<Vertex> vertices;   // host copy of the vertex data, used for batching
+    std::vector<GLushort> indices;  // host copy of the index data, used for batching
 };
 
 /// GLObject reference type alias
@@ -99,6 +253,11 @@ using GLObjectRef = std::shared_ptr<GLObject>;
 /// Create an Object in GPU memory
 GLObject create_gl_object(const Vertex vertices[], const size_t num_vertices, const GLushort indices[], const size_t num_indices, GLenum usage = GL_STATIC_DRAW)
 {
+    if (g_headless) {
+        return {0, 0, 0, num_vertices, num_indices,
+                std::vector<Vertex>(vertices, vertices + num_vertices),
+                std::vector<GLushort>(indices, indices + num_indices)};
+    }
     GLuint vao, vbo, ebo;
     glGenVertexArrays(1, &vao);
     glGenBuffers(1, &vbo);
@@ -113,7 +272,22 @@ GLObject create_gl_object(const Vertex vertices[], const size_t num_vertices, co
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
     glBufferData(GL_ELEMENT_ARRAY_BUFFER, num_indices * sizeof(GLushort), indices, usage);
     glBindVertexArray(0);
-    return {vao, vbo, ebo, num_vertices, num_indices};
+    return {vao, vbo, ebo, num_vertices, num_indices,
+            std::vector<Vertex>(vertices, vertices + num_vertices),
+            std::vector<GLushort>(indices, indices + num_indices)};
+}
+
+/// Share ownership of a GLObject, freeing its GPU buffers with the last reference
+GLObjectRef make_gl_object_ref(GLObject glo)
+{
+    return GLObjectRef(new GLObject(std::move(glo)), [](GLObject* glo) {
+        if (!g_headless) {
+            glDeleteVertexArrays(1, &glo->vao);
+            glDeleteBuffers(1, &glo->vbo);
+            glDeleteBuffers(1, &glo->ebo);
+        }
+        delete glo;
+    });
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
@@ -193,6 +367,42 @@ struct SpriteAnimation {
     SpriteFrame& curr_frame() { return frames[curr_frame_idx]; }
 };
 
+///////////////////////////////////////////////////////////////////////////////////////////////////
+/// Geometry Cache
+
+/// Registry of quad meshes in GPU memory, shared by all objects with identical geometry.
+/// Entries are weak, a mesh is freed once no object uses it anymore.
+struct GeometryCache {
+    /// Sprite frame count (0 for a single quad), extent, texture offset, texture size and usage
+    using Key = std::tuple<size_t, float, float, float, float, float, float, GLenum>;
+    std::map<Key, std::weak_ptr<GLObject>> objects;
+
+    /// Get the QUAD from gen_quad_geometry with the given parameters, uploading it on first use
+    GLObjectRef quad(glm::vec2 v, glm::vec2 to, glm::vec2 ts, GLenum usage = GL_STATIC_DRAW) {
+        std::weak_ptr<GLObject>& entry = objects[{0, v.x, v.y, to.x, to.y, ts.x, ts.y, usage}];
+        if (GLObjectRef glo = entry.lock())
+            return glo;
+        auto [vertices, indices] = gen_quad_geometry(v, to, ts);
+        GLObjectRef glo = make_gl_object_ref(create_gl_object(vertices.data(), vertices.size(), indices.data(), indices.size(), usage));
+        entry = glo;
+        return glo;
+    }
+
+    /// Get the QUADs from gen_sprite_quads with the given parameters, uploading them on first use
+    GLObjectRef sprite_quads(size_t count, glm::vec2 v, glm::vec2 to, glm::vec2 ts, GLenum usage = GL_STATIC_DRAW) {
+        std::weak_ptr<GLObject>& entry = objects[{count, v.x, v.y, to.x, to.y, ts.x, ts.y, usage}];
+        if (GLObjectRef glo = entry.lock())
+            return glo;
+        auto [vertices, indices] = gen_sprite_quads(count, v, to, ts);
+        GLObjectRef glo = make_gl_object_ref(create_gl_object(vertices.data(), vertices.size(), indices.data(), indices.size(), usage));
+        entry = glo;
+        return glo;
+    }
+};
+
+/// GeometryCache reference type alias
+using GeometryCacheRef = std::shared_ptr<GeometryCache>;
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 /// Textures
 
@@ -204,6 +414,8 @@ using GLTextureRef = std::shared_ptr<GLTexture>;
 /// Read file and upload RGB/RBGA texture to GPU memory
 auto load_rgba_texture(const std::string& inpath) -> std::optional<GLTexture>
 {
+    ScopeTimer timer("load_rgba_texture");
+    if (g_headless) return GLTexture(0);
     const std::string filepath = ASSETS_PATH + "/"s + inpath;
     int width, height, channels;
     stbi_set_flip_vertically_on_load(true);
@@ -226,6 +438,119 @@ auto load_rgba_texture(const std::string& inpath) -> std::optional<GLTexture>
     return texture;
 }
 
+/// Registry of textures in GPU memory keyed by asset path.
+/// Each image is decoded once while referenced, its texture is deleted when the last reference goes away.
+struct TextureCache {
+    std::unordered_map<std::string, std::weak_ptr<GLTexture>> textures;
+
+    /// Get the texture of the given asset path, loading it if not alive yet
+    GLTextureRef load(const std::string& inpath) {
+        std::weak_ptr<GLTexture>& entry = textures[inpath];
+        if (GLTextureRef texture = entry.lock())
+            return texture;
+        auto texture = load_rgba_texture(inpath);
+        if (!texture)
+            return nullptr;
+        GLTextureRef ref(new GLTexture(*texture), [](GLTexture* texture) {
+            if (!g_headless) glDeleteTextures(1, texture);
+            delete texture;
+        });
+        entry = ref;
+        return ref;
+    }
+};
+
+/// TextureCache reference type alias
+using TextureCacheRef = std::shared_ptr<TextureCache>;
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+/// Sprite Batch
+
+/// Max number of vertices streamed in a single batch draw call
+constexpr size_t kSpriteBatchMaxVertices = 4 * 16384;
+
+/// Accumulates pre-transformed geometry of many objects into one streaming vertex buffer,
+/// issuing a single draw call per run of consecutive objects that share the same texture.
+/// The shader must have identity model and zero texoffset while flushing.
+struct SpriteBatch {
+    GLuint vao;
+    GLuint vbo;
+    GLuint ebo;
+    GLTexture texture;             // texture of the current run
+    std::vector<Vertex> vertices;  // world-space vertices of the current run
+    std::vector<GLuint> indices;   // indices of the current run
+    size_t num_draws;              // draw calls issued since last reset, for stats
+
+    /// Create the streaming buffers in GPU memory
+    static SpriteBatch create() {
+        GLuint vao, vbo, ebo;
+        glGenVertexArrays(1, &vao);
+        glGenBuffers(1, &vbo);
+        glGenBuffers(1, &ebo);
+        glBindVertexArray(vao);
+        glBindBuffer(GL_ARRAY_BUFFER, vbo);
+        glBufferData(GL_ARRAY_BUFFER, kSpriteBatchMaxVertices * sizeof(Vertex), nullptr, GL_STREAM_DRAW);
+        glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid *)offsetof(Vertex, pos));
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid *)offsetof(Vertex, texcoord));
+        glEnableVertexAttribArray(1);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, kSpriteBatchMaxVertices * 2 * sizeof(GLuint), nullptr, GL_STREAM_DRAW);
+        glBindVertexArray(0);
+        SpriteBatch batch{ .vao = vao, .vbo = vbo, .ebo = ebo, .texture = 0, .vertices = {}, .indices = {}, .num_draws = 0 };
+        batch.vertices.reserve(kSpriteBatchMaxVertices);
+        batch.indices.reserve(kSpriteBatchMaxVertices * 2);
+        return batch;
+    }
+
+    /// Append the elements of a GLObject (or of its current sprite frame) transformed by model
+    void push(const GLTexture& tex, const GLObject& glo, const glm::mat4& model,
+              const glm::vec2 texoffset, const std::optional<SpriteFrame> sprite) {
+        size_t first = sprite ? sprite->ebo_offset / sizeof(GLushort) : 0;
+        size_t count = sprite ? sprite->ebo_count : glo.num_indices;
+        if (count == 0) return;
+        // only the vertices referenced by this range of elements are copied
+        GLushort lo = glo.indices[first], hi = glo.indices[first];
+        for (size_t i = first; i < first + count; i++) {
+            lo = std::min(lo, glo.indices[i]);
+            hi = std::max(hi, glo.indices[i]);
+        }
+        size_t num_vertices = hi - lo + 1;
+        if (tex != texture || vertices.size() + num_vertices > kSpriteBatchMaxVertices || indices.size() + count > kSpriteBatchMaxVertices * 2)
+            flush();
+        texture = tex;
+        GLuint base = vertices.size();
+        for (size_t v = lo; v <= hi; v++) {
+            const Vertex& vertex = glo.vertices[v];
+            vertices.push_back(Vertex{
+                .pos = glm::vec2(model * glm::vec4(vertex.pos, 0.0f, 1.0f)),
+                .texcoord = vertex.texcoord + texoffset,
+            });
+        }
+        for (size_t i = first; i < first + count; i++)
+            indices.push_back(base + glo.indices[i] - lo);
+    }
+
+    /// Upload and draw the current run, if any
+    void flush() {
+        if (indices.empty()) return;
+        glBindVertexArray(vao);
+        // orphan the buffers so the driver doesn't stall on draws still in flight
+        glBindBuffer(GL_ARRAY_BUFFER, vbo);
+        glBufferData(GL_ARRAY_BUFFER, kSpriteBatchMaxVertices * sizeof(Vertex), nullptr, GL_STREAM_DRAW);
+        glBufferSubData(GL_ARRAY_BUFFER, 0, vertices.size() * sizeof(Vertex), vertices.data());
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, kSpriteBatchMaxVertices * 2 * sizeof(GLuint), nullptr, GL_STREAM_DRAW);
+        glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, 0, indices.size() * sizeof(GLuint), indices.data());
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glDrawElements(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, (const void*)0);
+        vertices.clear();
+        indices.clear();
+        num_draws++;
+    }
+};
+
 //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 /// Window | Viewport | Camera
 
@@ -266,6 +591,22 @@ struct Camera {
     }
 };
 
+/// Uniform buffer with the camera matrices, bound to the Camera block of every shader program
+struct CameraUniformBuffer {
+    GLuint ubo;
+
+    /// Create the buffer in GPU memory and bind it to the Camera binding point
+    static CameraUniformBuffer create() {
+        GLuint ubo;
+        glGenBuffers(1, &ubo);
+        glBindBuffer(GL_UNIFORM_BUFFER, ubo);
+        glBufferData(GL_UNIFORM_BUFFER, 2 * sizeof(glm::mat4), nullptr, GL_DYNAMIC_DRAW);
+        glBindBufferBase(GL_UNIFORM_BUFFER, kCameraUniformBinding, ubo);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+        return { ubo };
+    }
+};
+
 //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 /// Collision
 
@@ -295,6 +636,57 @@ bool collision(const Aabb& a, const Aabb& b)
          a.max.y > b.min.y;
 }
 
+/// Side length of a broadphase grid cell, in world units
+constexpr float kColliderCellSize = 4.f;
+
+/// Uniform grid (spatial hash) of static colliders, with their world-space AABBs cached,
+/// so that moving objects only test the colliders in the cells they overlap
+struct ColliderGrid {
+    std::vector<Aabb> colliders;                                     // world-space AABBs
+    std::unordered_map<uint64_t, std::vector<uint32_t>> cells;       // cell key -> collider indices
+    std::vector<uint32_t> last_query;                                // query stamp per collider
+    uint32_t query_count = 0;
+
+    /// Hash key of a grid cell
+    static uint64_t cell_key(int x, int y) { return (uint64_t)(uint32_t)x << 32 | (uint32_t)y; }
+
+    /// Range of grid cells overlapped by an AABB
+    static auto cell_range(const Aabb& aabb) -> std::tuple<glm::ivec2, glm::ivec2> {
+        glm::ivec2 min = glm::floor(aabb.min / glm::vec2(kColliderCellSize));
+        glm::ivec2 max = glm::floor(aabb.max / glm::vec2(kColliderCellSize));
+        return {min, max};
+    }
+
+    /// Insert a static collider given its world-space AABB
+    void insert(const Aabb& aabb) {
+        uint32_t idx = colliders.size();
+        colliders.push_back(aabb);
+        last_query.push_back(0);
+        auto [min, max] = cell_range(aabb);
+        for (int x = min.x; x <= max.x; x++)
+            for (int y = min.y; y <= max.y; y++)
+                cells[cell_key(x, y)].push_back(idx);
+    }
+
+    /// Invoke fn once for every collider sharing a cell with the given world-space AABB
+    template<typename Fn>
+    void query(const Aabb& aabb, Fn&& fn) {
+        query_count++;
+        auto [min, max] = cell_range(aabb);
+        for (int x = min.x; x <= max.x; x++) {
+            for (int y = min.y; y <= max.y; y++) {
+                auto cell = cells.find(cell_key(x, y));
+                if (cell == cells.end()) continue;
+                for (uint32_t idx : cell->second) {
+                    if (last_query[idx] == query_count) continue;
+                    last_query[idx] = query_count;
+                    fn(colliders[idx]);
+                }
+            }
+        }
+    }
+};
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 /// Components
 
@@ -316,6 +708,7 @@ struct Transform {
 struct Motion {
     glm::vec2 velocity     {0.0f};
     glm::vec2 acceleration {0.0f};
+    glm::vec2 prev_position{0.0f};  // position before the last tick, for render interpolation
 };
 
 /// Gravity component
@@ -333,6 +726,10 @@ struct TextureOffset {
     glm::vec2 vec {0.0f};
 };
 
+/// Static Chunk component, marks an object whose mesh holds the world-space geometry of many tiles
+struct StaticChunk {
+};
+
 /// Entity State component
 enum class EntityState {
     IDLE,
@@ -340,6 +737,55 @@ enum class EntityState {
     JUMPING,
 };
 
+///////////////////////////////////////////////////////////////////////////////////////////////////
+/// ECS
+
+/// Entity identifier, indexes the sparse arrays of every component storage
+using Entity = uint32_t;
+/// Invalid entity identifier
+constexpr Entity kNullEntity = std::numeric_limits<Entity>::max();
+
+/// Storage of a single component type.
+/// Components are packed contiguously in the dense array, so systems iterate
+/// only over the entities that have the component, in contiguous memory.
+template<typename T>
+struct ComponentArray {
+    std::vector<T> dense;          // packed components
+    std::vector<Entity> entities;  // owner of each packed component
+    std::vector<uint32_t> sparse;  // entity -> index into dense, kNullEntity if none
+
+    size_t size() const { return dense.size(); }
+    bool has(Entity e) const { return e < sparse.size() && sparse[e] != kNullEntity; }
+    /// Get component of entity, nullptr if the entity doesn't have it
+    T* get(Entity e) { return has(e) ? &dense[sparse[e]] : nullptr; }
+    /// Get component of entity, which must have it
+    T& operator[](Entity e) { return dense[sparse[e]]; }
+
+    /// Add or replace the component of an entity
+    T& emplace(Entity e, T component) {
+        if (e >= sparse.size())
+            sparse.resize(e + 1, kNullEntity);
+        if (has(e))
+            return dense[sparse[e]] = std::move(component);
+        sparse[e] = dense.size();
+        dense.push_back(std::move(component));
+        entities.push_back(e);
+        return dense.back();
+    }
+
+    /// Remove the component of an entity, if any, by moving the last one into its slot
+    void remove(Entity e) {
+        if (!has(e)) return;
+        uint32_t idx = sparse[e];
+        dense[idx] = std::move(dense.back());
+        entities[idx] = entities.back();
+        sparse[entities[idx]] = idx;
+        dense.pop_back();
+        entities.pop_back();
+        sparse[e] = kNullEntity;
+    }
+};
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 /// Forward-declarations
 
@@ -355,7 +801,7 @@ using KeyStateMap = std::unordered_map<Key, bool>;
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 /// Game
 
-/// Game Object represents an Entity's data
+/// Game Object describes all components of an Entity before it is spawned into the World
 struct GameObject {
     Transform transform;
     Motion motion;
@@ -367,30 +813,87 @@ struct GameObject {
     std::optional<EntityState> entity_state;
     std::optional<Gravity> gravity;
     std::optional<Aabb> aabb;
+    std::optional<StaticChunk> static_chunk;
+};
+
+/// Mesh component, geometry and texture to render an entity with
+struct Mesh {
+    GLObjectRef glo;
+    GLTextureRef texture;
+};
+
+/// All entities of a Scene, with their components in dense per-component arrays
+struct World {
+    Entity num_entities = 0;
+    ComponentArray<Transform> transforms;
+    ComponentArray<Motion> motions;
+    ComponentArray<Mesh> meshes;
+    ComponentArray<TextureSlide> texture_slides;
+    ComponentArray<TextureOffset> texture_offsets;
+    ComponentArray<SpriteAnimation> sprite_animations;
+    ComponentArray<EntityState> entity_states;
+    ComponentArray<Gravity> gravities;
+    ComponentArray<Aabb> aabbs;
+    ComponentArray<StaticChunk> static_chunks;
+
+    /// Create a new entity with the components described by a GameObject.
+    /// Motion is only stored for objects that move or fall.
+    Entity spawn(GameObject&& obj) {
+        Entity e = num_entities++;
+        transforms.emplace(e, obj.transform);
+        if (obj.gravity || obj.motion.velocity != glm::vec2(0.f) || obj.motion.acceleration != glm::vec2(0.f))
+            motions.emplace(e, Motion{ obj.motion.velocity, obj.motion.acceleration, obj.transform.position });
+        if (obj.glo && obj.texture)
+            meshes.emplace(e, Mesh{ std::move(obj.glo), std::move(obj.texture) });
+        if (obj.texture_slide) texture_slides.emplace(e, *obj.texture_slide);
+        if (obj.texture_offset) texture_offsets.emplace(e, *obj.texture_offset);
+        if (obj.sprite_animation) sprite_animations.emplace(e, std::move(*obj.sprite_animation));
+        if (obj.entity_state) entity_states.emplace(e, *obj.entity_state);
+        if (obj.gravity) gravities.emplace(e, *obj.gravity);
+        if (obj.aabb) aabbs.emplace(e, *obj.aabb);
+        if (obj.static_chunk) static_chunks.emplace(e, *obj.static_chunk);
+        return e;
+    }
+
+    /// Transform of an entity at render time, interpolated between the last two ticks
+    Transform interpolated(Entity e, float alpha) {
+        Transform transform = transforms[e];
+        if (Motion* motion = motions.get(e))
+            transform.position = glm::mix(motion->prev_position, transform.position, alpha);
+        return transform;
+    }
 };
 
-/// Lists of all Game Objects in a Scene, divised in layers, in order of render
+/// Lists of all Entities in a Scene, divised in layers, in order of render
 struct ObjectLists {
-    std::vector<GameObject> background;
-    std::vector<GameObject> platform;
-    std::vector<GameObject> entity;
+    std::vector<Entity> background;
+    std::vector<Entity> platform;
+    std::vector<Entity> entity;
     /// Get all layers of objects
     auto all_lists() { return std::array{ &background, &platform, &entity }; }
 };
 
 /// Generic Scene structure
 struct Scene {
+    World world;
     ObjectLists objects;
+    ColliderGrid colliders;
     glm::vec4 bg_color;
-    GameObject& player() { return objects.entity.front(); }
+    Entity player() { return objects.entity.front(); }
 };
 
 /// All Game data
 struct Game {
     Window window;
     Viewport viewport;
-    GLuint shader_program;
+    ShaderProgram shader_program;
+    std::optional<CameraUniformBuffer> camera_ubo;
+    GeometryCacheRef geometry_cache;
+    TextureCacheRef texture_cache;
     GLObjectRef canvas_quad_glo;
+    GLObjectRef grid_quad_glo;  // unit quad outlined by render_grid
+    GLObjectRef aabb_quad_glo;  // stream quad, its vertices are overwritten for every AABB in render_aabbs
+    std::optional<SpriteBatch> sprite_batch;
     glm::vec2 map_size;
     GLTextureRef white_texture;
     GLTextureRef black_texture;
@@ -401,18 +904,75 @@ struct Game {
     bool debug_aabb;
 };
 
+/// Number of tiles along each axis of a static chunk mesh
+constexpr int kTileChunkSize = 32;
+
+/// Merge all static textured tiles into one mesh per chunk and texture.
+/// Tiles with motion, animation, texture sliding or collision are left untouched.
+void build_tile_chunks(std::vector<GameObject>& objects)
+{
+    struct ChunkMesh {
+        GLTextureRef texture;
+        std::vector<Vertex> vertices;
+        std::vector<GLushort> indices;
+    };
+    // a chunk is split into several meshes when it outgrows GLushort indices
+    std::map<std::tuple<int, int, GLTexture>, std::vector<ChunkMesh>> chunks;
+    std::vector<GameObject> others;
+
+    for (auto& obj : objects) {
+        bool is_static_tile = obj.glo && obj.texture && !obj.static_chunk && !obj.aabb && !obj.gravity
+            && !obj.sprite_animation && !obj.texture_slide
+            && obj.motion.velocity == glm::vec2(0.f) && obj.motion.acceleration == glm::vec2(0.f);
+        if (!is_static_tile) {
+            others.push_back(std::move(obj));
+            continue;
+        }
+        glm::ivec2 chunk_idx = glm::floor(obj.transform.position / glm::vec2(kTileChunkSize));
+        auto& meshes = chunks[{chunk_idx.x, chunk_idx.y, *obj.texture}];
+        if (meshes.empty() || meshes.back().vertices.size() + obj.glo->vertices.size() > 0xFFFF)
+            meshes.emplace_back();
+        ChunkMesh& chunk = meshes.back();
+        chunk.texture = obj.texture;
+        glm::mat4 model = obj.transform.matrix();
+        glm::vec2 texoffset = obj.texture_offset ? obj.texture_offset->vec : glm::vec2(0.f);
+        GLushort base = chunk.vertices.size();
+        for (const Vertex& vertex : obj.glo->vertices) {
+            chunk.vertices.push_back(Vertex{
+                .pos = glm::vec2(model * glm::vec4(vertex.pos, 0.0f, 1.0f)),
+                .texcoord = vertex.texcoord + texoffset,
+            });
+        }
+        for (GLushort index : obj.glo->indices)
+            chunk.indices.push_back(base + index);
+    }
+
+    objects.clear();
+    for (auto& [key, meshes] : chunks) {
+        for (auto& chunk : meshes) {
+            objects.push_back({});
+            auto& obj = objects.back();
+            obj.glo = make_gl_object_ref(create_gl_object(chunk.vertices.data(), chunk.vertices.size(), chunk.indices.data(), chunk.indices.size()));
+            obj.texture = chunk.texture;
+            obj.static_chunk = StaticChunk{};
+        }
+    }
+    std::move(others.begin(), others.end(), std::back_inserter(objects));
+}
+
 /// Load Main Scene
 Scene load_scene(const Game& game)
 {
+    ScopeTimer timer("load_scene");
     Scene scene;
     scene.bg_color = glm::vec4(glm::vec3(0xF8, 0xE0, 0xB0) / glm::vec3(255.f), 1.0f);
 
     // Backgrounds ============================================================
-    auto& backgrounds = scene.objects.background;
+    std::vector<GameObject> backgrounds;
     backgrounds.push_back({});
     auto& snow_mountains = backgrounds.back();
     snow_mountains.glo = game.canvas_quad_glo;
-    snow_mountains.texture = std::make_shared<GLTexture>(*load_rgba_texture("bg-mountain-snow.png"));
+    snow_mountains.texture = game.texture_cache->load("bg-mountain-snow.png");
     snow_mountains.transform.position = game.camera->canvas / glm::vec2(2.f);
     snow_mountains.transform.scale = game.camera->canvas / glm::vec2(2.f);
     snow_mountains.texture_slide = TextureSlide{
@@ -424,7 +984,7 @@ Scene load_scene(const Game& game)
     backgrounds.push_back({});
     auto& green_mountains = backgrounds.back();
     green_mountains.glo = game.canvas_quad_glo;
-    green_mountains.texture = std::make_shared<GLTexture>(*load_rgba_texture("bg-mountain-green.png"));
+    green_mountains.texture = game.texture_cache->load("bg-mountain-green.png");
     green_mountains.transform.position = game.camera->canvas / glm::vec2(2.f);
     green_mountains.transform.scale = game.camera->canvas / glm::vec2(2.f);
     green_mountains.texture_slide = TextureSlide{
@@ -436,7 +996,7 @@ Scene load_scene(const Game& game)
     backgrounds.push_back({});
     auto& clouds = backgrounds.back();
     clouds.glo = game.canvas_quad_glo;
-    clouds.texture = std::make_shared<GLTexture>(*load_rgba_texture("bg-clouds.png"));
+    clouds.texture = game.texture_cache->load("bg-clouds.png");
     clouds.texture_slide = TextureSlide{
         .velocity = glm::vec2(0.07f, 0.f),
         .acceleration = glm::vec2(0.f),
@@ -446,7 +1006,7 @@ Scene load_scene(const Game& game)
     clouds.transform.scale = game.camera->canvas / glm::vec2(2.f);
 
     // Platform Blocks ========================================================
-    GLTextureRef tileset_tex = std::make_shared<GLTexture>(*load_rgba_texture("tiles-2.png"));
+    GLTextureRef tileset_tex = game.texture_cache->load("tiles-2.png");
     constexpr glm::vec2 tileset_size = glm::vec2(339.f, 339.f);
     constexpr glm::vec2 tile_normal_size = glm::vec2(16.f / 339.f);
     constexpr glm::vec2 tile_offset_green_middle_top = glm::vec2(34.f, 221.f);
@@ -456,22 +1016,20 @@ Scene load_scene(const Game& game)
     constexpr glm::vec2 tile_offset_green_left_bottom = glm::vec2(0.f, 204.f);
     constexpr glm::vec2 tile_offset_green_right_bottom = glm::vec2(68.f, 204.f);
 
-    auto& platform = scene.objects.platform;
+    std::vector<GameObject> platform;
 
     // Ground =================================================================
     for (float i = 0; i < game.camera->canvas.x * 3; i++) {
         platform.push_back({});
         auto& tile_top = platform.back();
-        auto [tile_top_vertices, tile_top_indices] = gen_quad_geometry(glm::vec2(1.f), tile_offset_green_middle_top / tileset_size, tile_normal_size);
-        tile_top.glo = std::make_shared<GLObject>(create_gl_object(tile_top_vertices.data(), tile_top_vertices.size(), tile_top_indices.data(), tile_top_indices.size()));
+        tile_top.glo = game.geometry_cache->quad(glm::vec2(1.f), tile_offset_green_middle_top / tileset_size, tile_normal_size);
         tile_top.texture = tileset_tex;
         tile_top.transform.scale = glm::vec2(0.5f);
         tile_top.transform.position = glm::vec2(tile_top.transform.scale.x + i, tile_top.transform.scale.y + 1.f);
 
         platform.push_back({});
         auto& tile_bottom = platform.back();
-        auto [tile_bottom_vertices, tile_bottom_indices] = gen_quad_geometry(glm::vec2(1.f), tile_offset_green_middle_bottom / tileset_size, tile_normal_size);
-        tile_bottom.glo = std::make_shared<GLObject>(create_gl_object(tile_bottom_vertices.data(), tile_bottom_vertices.size(), tile_bottom_indices.data(), tile_bottom_indices.size()));
+        tile_bottom.glo = game.geometry_cache->quad(glm::vec2(1.f), tile_offset_green_middle_bottom / tileset_size, tile_normal_size);
         tile_bottom.texture = tileset_tex;
         tile_bottom.transform.scale = glm::vec2(0.5f);
         tile_bottom.transform.position = glm::vec2(tile_bottom.transform.scale.x + i, tile_bottom.transform.scale.y);
@@ -482,24 +1040,21 @@ Scene load_scene(const Game& game)
     {
         platform.push_back({});
         auto& tile_top_left = platform.back();
-        auto [tile_top_left_vertices, tile_top_left_indices] = gen_quad_geometry(glm::vec2(1.f), tile_offset_green_left_top / tileset_size, tile_normal_size);
-        tile_top_left.glo = std::make_shared<GLObject>(create_gl_object(tile_top_left_vertices.data(), tile_top_left_vertices.size(), tile_top_left_indices.data(), tile_top_left_indices.size()));
+        tile_top_left.glo = game.geometry_cache->quad(glm::vec2(1.f), tile_offset_green_left_top / tileset_size, tile_normal_size);
         tile_top_left.texture = tileset_tex;
         tile_top_left.transform.scale = glm::vec2(0.5f);
         tile_top_left.transform.position = glm::vec2(platf1_offset.x + tile_top_left.transform.scale.x, platf1_offset.y + tile_top_left.transform.scale.y + 2.f);
 
         platform.push_back({});
         auto& tile_middle_left = platform.back();
-        auto [tile_middle_left_vertices, tile_middle_left_indices] = gen_quad_geometry(glm::vec2(1.f), tile_offset_green_left_bottom / tileset_size, tile_normal_size);
-        tile_middle_left.glo = std::make_shared<GLObject>(create_gl_object(tile_middle_left_vertices.data(), tile_middle_left_vertices.size(), tile_middle_left_indices.data(), tile_middle_left_indices.size()));
+        tile_middle_left.glo = game.geometry_cache->quad(glm::vec2(1.f), tile_offset_green_left_bottom / tileset_size, tile_normal_size);
         tile_middle_left.texture = tileset_tex;
         tile_middle_left.transform.scale = glm::vec2(0.5f);
         tile_middle_left.transform.position = glm::vec2(platf1_offset.x + tile_middle_left.transform.scale.x, platf1_offset.y + tile_middle_left.transform.scale.y + 1.f);
 
         platform.push_back({});
         auto& tile_bottom_left = platform.back();
-        auto [tile_bottom_left_vertices, tile_bottom_left_indices] = gen_quad_geometry(glm::vec2(1.f), tile_offset_green_left_bottom / tileset_size, tile_normal_size);
-        tile_bottom_left.glo = std::make_shared<GLObject>(create_gl_object(tile_bottom_left_vertices.data(), tile_bottom_left_vertices.size(), tile_bottom_left_indices.data(), tile_bottom_left_indices.size()));
+        tile_bottom_left.glo = game.geometry_cache->quad(glm::vec2(1.f), tile_offset_green_left_bottom / tileset_size, tile_normal_size);
         tile_bottom_left.texture = tileset_tex;
         tile_bottom_left.transform.scale = glm::vec2(0.5f);
         tile_bottom_left.transform.position = glm::vec2(platf1_offset.x + tile_bottom_left.transform.scale.x, platf1_offset.y + tile_bottom_left.transform.scale.y + 0.f);
@@ -509,8 +1064,7 @@ Scene load_scene(const Game& game)
         {
             platform.push_back({});
             auto& tile_top = platform.back();
-            auto [tile_vertices, tile_indices] = gen_quad_geometry(glm::vec2(1.f), tile_offset_green_middle_top / tileset_size, tile_normal_size);
-            tile_top.glo = std::make_shared<GLObject>(create_gl_object(tile_vertices.data(), tile_vertices.size(), tile_indices.data(), tile_indices.size()));
+            tile_top.glo = game.geometry_cache->quad(glm::vec2(1.f), tile_offset_green_middle_top / tileset_size, tile_normal_size);
             tile_top.texture = tileset_tex;
             tile_top.transform.scale = glm::vec2(0.5f);
             tile_top.transform.position = glm::vec2(platf1_offset.x + tile_top.transform.scale.x + i, platf1_offset.y + tile_top.transform.scale.y + 2.f);
@@ -519,8 +1073,7 @@ Scene load_scene(const Game& game)
         {
             platform.push_back({});
             auto& tile_middle = platform.back();
-            auto [tile_vertices, tile_indices] = gen_quad_geometry(glm::vec2(1.f), tile_offset_green_middle_bottom / tileset_size, tile_normal_size);
-            tile_middle.glo = std::make_shared<GLObject>(create_gl_object(tile_vertices.data(), tile_vertices.size(), tile_indices.data(), tile_indices.size()));
+            tile_middle.glo = game.geometry_cache->quad(glm::vec2(1.f), tile_offset_green_middle_bottom / tileset_size, tile_normal_size);
             tile_middle.texture = tileset_tex;
             tile_middle.transform.scale = glm::vec2(0.5f);
             tile_middle.transform.position = glm::vec2(platf1_offset.x + tile_middle.transform.scale.x + i, platf1_offset.y + tile_middle.transform.scale.y + 1.f);
@@ -529,8 +1082,7 @@ Scene load_scene(const Game& game)
         {
             platform.push_back({});
             auto& tile_bottom = platform.back();
-            auto [tile_vertices, tile_indices] = gen_quad_geometry(glm::vec2(1.f), tile_offset_green_middle_bottom / tileset_size, tile_normal_size);
-            tile_bottom.glo = std::make_shared<GLObject>(create_gl_object(tile_vertices.data(), tile_vertices.size(), tile_indices.data(), tile_indices.size()));
+            tile_bottom.glo = game.geometry_cache->quad(glm::vec2(1.f), tile_offset_green_middle_bottom / tileset_size, tile_normal_size);
             tile_bottom.texture = tileset_tex;
             tile_bottom.transform.scale = glm::vec2(0.5f);
             tile_bottom.transform.position = glm::vec2(platf1_offset.x + tile_bottom.transform.scale.x + i, platf1_offset.y + tile_bottom.transform.scale.y + 0.f);
@@ -541,8 +1093,7 @@ Scene load_scene(const Game& game)
         {
             platform.push_back({});
             auto& tile_top_right = platform.back();
-            auto [tile_vertices, tile_indices] = gen_quad_geometry(glm::vec2(1.f), tile_offset_green_right_top / tileset_size, tile_normal_size);
-            tile_top_right.glo = std::make_shared<GLObject>(create_gl_object(tile_vertices.data(), tile_vertices.size(), tile_indices.data(), tile_indices.size()));
+            tile_top_right.glo = game.geometry_cache->quad(glm::vec2(1.f), tile_offset_green_right_top / tileset_size, tile_normal_size);
             tile_top_right.texture = tileset_tex;
             tile_top_right.transform.scale = glm::vec2(0.5f);
             tile_top_right.transform.position = glm::vec2(platf1_offset.x + tile_top_right.transform.scale.x + 6, platf1_offset.y + tile_top_right.transform.scale.y + 2.f);
@@ -551,8 +1102,7 @@ Scene load_scene(const Game& game)
         {
             platform.push_back({});
             auto& tile_middle_right = platform.back();
-            auto [tile_vertices, tile_indices] = gen_quad_geometry(glm::vec2(1.f), tile_offset_green_right_bottom / tileset_size, tile_normal_size);
-            tile_middle_right.glo = std::make_shared<GLObject>(create_gl_object(tile_vertices.data(), tile_vertices.size(), tile_indices.data(), tile_indices.size()));
+            tile_middle_right.glo = game.geometry_cache->quad(glm::vec2(1.f), tile_offset_green_right_bottom / tileset_size, tile_normal_size);
             tile_middle_right.texture = tileset_tex;
             tile_middle_right.transform.scale = glm::vec2(0.5f);
             tile_middle_right.transform.position = glm::vec2(platf1_offset.x + tile_middle_right.transform.scale.x + 6, platf1_offset.y + tile_middle_right.transform.scale.y + 1.f);
@@ -561,8 +1111,7 @@ Scene load_scene(const Game& game)
         {
             platform.push_back({});
             auto& tile_bottom_right = platform.back();
-            auto [tile_vertices, tile_indices] = gen_quad_geometry(glm::vec2(1.f), tile_offset_green_right_bottom / tileset_size, tile_normal_size);
-            tile_bottom_right.glo = std::make_shared<GLObject>(create_gl_object(tile_vertices.data(), tile_vertices.size(), tile_indices.data(), tile_indices.size()));
+            tile_bottom_right.glo = game.geometry_cache->quad(glm::vec2(1.f), tile_offset_green_right_bottom / tileset_size, tile_normal_size);
             tile_bottom_right.texture = tileset_tex;
             tile_bottom_right.transform.scale = glm::vec2(0.5f);
             tile_bottom_right.transform.position = glm::vec2(platf1_offset.x + tile_bottom_right.transform.scale.x + 6, platf1_offset.y + tile_bottom_right.transform.scale.y + 0.f);
@@ -573,8 +1122,6 @@ Scene load_scene(const Game& game)
     {   // groud
         platform.push_back({});
         auto& obj = platform.back();
-        auto [vertices, indices] = gen_quad_geometry(glm::vec2(1.f), glm::vec2(0.f), glm::vec2(1.0f));
-        obj.glo = std::make_shared<GLObject>(create_gl_object(vertices.data(), vertices.size(), indices.data(), indices.size()));
         obj.aabb = Aabb{ .min= {-1.f, -1.f}, .max = {+1.f, +0.99f} };
         obj.transform.position = glm::vec2(game.map_size.x / 2.f, 1.f);
         obj.transform.scale = glm::vec2(game.map_size.x / 2.f, 1.f);
@@ -582,8 +1129,6 @@ Scene load_scene(const Game& game)
     {   // platf1
         platform.push_back({});
         auto& obj = platform.back();
-        auto [vertices, indices] = gen_quad_geometry(glm::vec2(1.f), glm::vec2(0.f), glm::vec2(1.0f));
-        obj.glo = std::make_shared<GLObject>(create_gl_object(vertices.data(), vertices.size(), indices.data(), indices.size()));
         obj.aabb = Aabb{ .min= {-0.98f, -1.f}, .max = {+0.98f, +0.99f} };
         obj.transform.position = glm::vec2(23.5f, 4.75f);
         obj.transform.scale = glm::vec2(3.5f, 0.25f);
@@ -591,7 +1136,7 @@ Scene load_scene(const Game& game)
 
 
     // Entities ===============================================================
-    auto& entities = scene.objects.entity;
+    std::vector<GameObject> entities;
     entities.push_back({});
     auto& mario = entities.back();
     constexpr glm::vec2 mario_spritesheet_size = glm::vec2(201.f, 120.f);
@@ -603,8 +1148,8 @@ Scene load_scene(const Game& game)
     for (auto& i : mario_indices2) { i += mario_vertices.size(); }
     mario_vertices.insert(mario_vertices.end(), mario_vertices2.begin(), mario_vertices2.end());
     mario_indices.insert(mario_indices.end(), mario_indices2.begin(), mario_indices2.end());
-    mario.glo = std::make_shared<GLObject>(create_gl_object(mario_vertices.data(), mario_vertices.size(), mario_indices.data(), mario_indices.size()));
-    mario.texture = std::make_shared<GLTexture>(*load_rgba_texture("mario-3.png"));
+    mario.glo = make_gl_object_ref(create_gl_object(mario_vertices.data(), mario_vertices.size(), mario_indices.data(), mario_indices.size()));
+    mario.texture = game.texture_cache->load("mario-3.png");
     mario.transform.scale = glm::vec2(1.2f);
     mario.transform.position = glm::vec2(10.f, 2.f + mario.transform.scale.y);
     mario.sprite_animation = SpriteAnimation{
@@ -621,6 +1166,23 @@ Scene load_scene(const Game& game)
     mario.gravity = Gravity{};
     mario.entity_state = EntityState::IDLE;
 
+    // Static Chunks ==========================================================
+    build_tile_chunks(platform);
+
+    // Static Colliders =======================================================
+    for (auto& obj : platform) {
+        if (obj.aabb)
+            scene.colliders.insert(obj.aabb->transform(obj.transform.matrix()));
+    }
+
+    // Spawn ==================================================================
+    for (auto& obj : backgrounds)
+        scene.objects.background.push_back(scene.world.spawn(std::move(obj)));
+    for (auto& obj : platform)
+        scene.objects.platform.push_back(scene.world.spawn(std::move(obj)));
+    for (auto& obj : entities)
+        scene.objects.entity.push_back(scene.world.spawn(std::move(obj)));
+
     return scene;
 }
 
@@ -631,12 +1193,19 @@ int game_init(Game& game, GLFWwindow* window)
     game.window.size = glm::uvec2(WIDTH, HEIGHT);
     game.viewport.size = glm::uvec2(WIDTH, HEIGHT);
     game.viewport.offset = glm::uvec2(0);
-    game.shader_program = load_shader_program();
-    auto [quad_vertices, quad_indices] = gen_quad_geometry(glm::vec2(1.f), glm::vec2(0.f), glm::vec2((float)WIDTH / (float)HEIGHT, 1.0f));
-    game.canvas_quad_glo = std::make_shared<GLObject>(create_gl_object(quad_vertices.data(), quad_vertices.size(), quad_indices.data(), quad_indices.size()));
+    if (!g_headless) {
+        game.shader_program = load_shader_program();
+        game.camera_ubo = CameraUniformBuffer::create();
+        game.sprite_batch = SpriteBatch::create();
+    }
+    game.geometry_cache = std::make_shared<GeometryCache>();
+    game.texture_cache = std::make_shared<TextureCache>();
+    game.canvas_quad_glo = game.geometry_cache->quad(glm::vec2(1.f), glm::vec2(0.f), glm::vec2((float)WIDTH / (float)HEIGHT, 1.0f));
+    game.grid_quad_glo = game.geometry_cache->quad(glm::vec2(1.f), glm::vec2(0.f), glm::vec2(1.0f));
+    game.aabb_quad_glo = game.geometry_cache->quad(glm::vec2(1.f), glm::vec2(0.f), glm::vec2(1.0f), GL_STREAM_DRAW);
     game.map_size = glm::vec2(90.f, 30.f);
-    game.white_texture = std::make_shared<GLTexture>(*load_rgba_texture("white.png"));
-    game.black_texture = std::make_shared<GLTexture>(*load_rgba_texture("black.png"));
+    game.white_texture = game.texture_cache->load("white.png");
+    game.black_texture = game.texture_cache->load("black.png");
     game.camera = Camera::create(game.viewport.aspect_ratio());
     game.scene = load_scene(game);
     game.key_states = KeyStateMap(GLFW_KEY_LAST);
@@ -649,46 +1218,73 @@ int game_init(Game& game, GLFWwindow* window)
 /// Game tick update
 void game_update(Game& game, float dt)
 {
-    // Update all objects
-    for (auto* object_list : game.scene->objects.all_lists()) {
-        for (auto& obj : *object_list) {
-            // Gravity system
-            if (obj.gravity && (!obj.entity_state || obj.entity_state != EntityState::JUMPING)) {
+    ScopeTimer timer("game_update");
+    World& world = game.scene->world;
+
+    // Gravity system
+    {
+        ScopeTimer timer("Gravity system");
+        for (Entity e : world.gravities.entities) {
+            EntityState* state = world.entity_states.get(e);
+            if (!state || *state != EntityState::JUMPING) {
                 constexpr float kGravityFactor = 20.f;
-                obj.motion.acceleration.y = -kGravityFactor;
-            }
-            // Motion system
-            obj.motion.velocity += obj.motion.acceleration * dt;
-            obj.transform.position += obj.motion.velocity * dt;
-            // Sprite Animation system
-            if (obj.sprite_animation) {
-                obj.sprite_animation->update_frame(dt);
-            }
-            // Texture Sliding system
-            if (obj.texture_slide && obj.texture_offset) {
-                obj.texture_slide->velocity += obj.texture_slide->acceleration * dt;
-                obj.texture_offset->vec += obj.texture_slide->velocity * dt;
+                world.motions[e].acceleration.y = -kGravityFactor;
             }
         }
     }
 
+    // Motion system
+    {
+        ScopeTimer timer("Motion system");
+        for (size_t i = 0; i < world.motions.size(); i++) {
+            Motion& motion = world.motions.dense[i];
+            Transform& transform = world.transforms[world.motions.entities[i]];
+            motion.prev_position = transform.position;
+            motion.velocity += motion.acceleration * dt;
+            transform.position += motion.velocity * dt;
+        }
+    }
+
+    // Sprite Animation system
+    {
+        ScopeTimer timer("Sprite Animation system");
+        for (auto& sprite_animation : world.sprite_animations.dense) {
+            sprite_animation.update_frame(dt);
+        }
+    }
+
+    // Texture Sliding system
+    {
+        ScopeTimer timer("Texture Sliding system");
+        for (size_t i = 0; i < world.texture_slides.size(); i++) {
+            TextureSlide& texture_slide = world.texture_slides.dense[i];
+            TextureOffset* texture_offset = world.texture_offsets.get(world.texture_slides.entities[i]);
+            if (!texture_offset) continue;
+            texture_slide.velocity += texture_slide.acceleration * dt;
+            texture_offset->vec += texture_slide.velocity * dt;
+        }
+    }
+
     // Collision system
     {
-        auto& entities = game.scene->objects.entity;
-        for (auto entt = entities.begin(); entt != entities.end(); entt++) {
-            auto& tiles = game.scene->objects.platform;
-            for (auto& tile : tiles) {
-                Aabb tile_aabb = tile.aabb->transform(tile.transform.matrix());
-                Aabb entt_aabb = entt->aabb->transform(entt->transform.matrix());
+        ScopeTimer timer("Collision system");
+        for (Entity e : game.scene->objects.entity) {
+            Aabb* aabb = world.aabbs.get(e);
+            if (!aabb) continue;
+            Transform& transform = world.transforms[e];
+            Aabb entt_aabb = aabb->transform(transform.matrix());
+            game.scene->colliders.query(entt_aabb, [&](const Aabb& tile_aabb) {
                 if (collision(tile_aabb, entt_aabb)) {
                     float y_top_diff = entt_aabb.max.y - tile_aabb.max.y;
                     float y_bottom_diff = entt_aabb.min.y - tile_aabb.max.y;
                     if (y_top_diff > 0.f && y_bottom_diff) {
-                        entt->transform.position.y += -y_bottom_diff;
-                        entt->motion.velocity.y = 0.f;
+                        transform.position.y += -y_bottom_diff;
+                        if (Motion* motion = world.motions.get(e))
+                            motion->velocity.y = 0.f;
+                        entt_aabb = aabb->transform(transform.matrix());
                     }
                 }
-            }
+            });
         }
     }
 }
@@ -703,20 +1299,22 @@ void begin_render(Game& game)
     glClear(GL_COLOR_BUFFER_BIT);
 }
 
-/// Upload camera matrix to shader
-void set_camera(const GLuint shader, const Camera& camera)
+/// Upload camera matrices to the shared camera uniform buffer
+void set_camera(const CameraUniformBuffer& camera_ubo, const Camera& camera)
 {
-    glUniformMatrix4fv(glGetUniformLocation(shader, "view"), 1, GL_FALSE, glm::value_ptr(camera.view));
-    glUniformMatrix4fv(glGetUniformLocation(shader, "projection"), 1, GL_FALSE, glm::value_ptr(camera.projection));
+    glBindBuffer(GL_UNIFORM_BUFFER, camera_ubo.ubo);
+    glBufferSubData(GL_UNIFORM_BUFFER, 0 * sizeof(glm::mat4), sizeof(glm::mat4), glm::value_ptr(camera.view));
+    glBufferSubData(GL_UNIFORM_BUFFER, 1 * sizeof(glm::mat4), sizeof(glm::mat4), glm::value_ptr(camera.projection));
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
 }
 
 /// Render a textured GLObject
-void draw_object(const GLuint shader, const GLTexture& texture, const GLObject& glo, const glm::mat4& model,
+void draw_object(const ShaderProgram& shader, const GLTexture& texture, const GLObject& glo, const glm::mat4& model,
                  const std::optional<TextureOffset> texoffset, const std::optional<SpriteFrame> sprite)
 {
-    glUniformMatrix4fv(glGetUniformLocation(shader, "model"), 1, GL_FALSE, glm::value_ptr(model));
+    glUniformMatrix4fv(shader.model, 1, GL_FALSE, glm::value_ptr(model));
     glm::vec2 texoffset_vec = texoffset ? texoffset->vec : glm::vec2(0.f);
-    glUniform2fv(glGetUniformLocation(shader, "texoffset"), 1, glm::value_ptr(texoffset_vec));
+    glUniform2fv(shader.texoffset, 1, glm::value_ptr(texoffset_vec));
     glActiveTexture(GL_TEXTURE0);
     glBindTexture(GL_TEXTURE_2D, texture);
     glBindVertexArray(glo.vao);
@@ -726,11 +1324,10 @@ void draw_object(const GLuint shader, const GLTexture& texture, const GLObject&
 }
 
 /// Render the canvas grid
-void render_grid(Game& game, GLuint shader)
+void render_grid(Game& game, const ShaderProgram& shader)
 {
     glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
-    auto [vertices, indices] = gen_quad_geometry(glm::vec2(1.f), glm::vec2(0.f), glm::vec2(1.0f));
-    GLObject glo = create_gl_object(vertices.data(), vertices.size(), indices.data(), indices.size());
+    const GLObject& glo = *game.grid_quad_glo;
     glBindVertexArray(glo.vao);
     for (float i = 0; i < game.camera->canvas.x; i++) {
         for (float j = 0; j < game.camera->canvas.y; j++) {
@@ -744,17 +1341,17 @@ void render_grid(Game& game, GLuint shader)
 }
 
 /// Render AABBs for all objects that have it
-void render_aabbs(Game& game, GLuint shader)
+void render_aabbs(Game& game, const ShaderProgram& shader, float alpha)
 {
     glLineWidth(1.0f);
     glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
-    auto [vertices, indices] = gen_quad_geometry(glm::vec2(1.f), glm::vec2(0.f), glm::vec2(1.0f));
-    GLObject glo = create_gl_object(vertices.data(), vertices.size(), indices.data(), indices.size(), GL_STREAM_DRAW);
+    const GLObject& glo = *game.aabb_quad_glo;
     glBindVertexArray(glo.vao);
+    World& world = game.scene->world;
     for (auto* object_list : game.scene->objects.all_lists()) {
-        for (auto obj = object_list->rbegin(); obj != object_list->rend(); obj++) {
-            if (obj->aabb) {
-                Aabb& aabb = *obj->aabb;
+        for (auto e = object_list->rbegin(); e != object_list->rend(); e++) {
+            if (Aabb* obj_aabb = world.aabbs.get(*e)) {
+                Aabb& aabb = *obj_aabb;
                 auto vertices = std::vector<Vertex>{
                     { .pos = { aabb.min.x, aabb.min.y }, .texcoord = { 1.0f, 0.0f } },
                     { .pos = { aabb.min.x, aabb.max.y }, .texcoord = { 1.0f, 1.0f } },
@@ -764,36 +1361,57 @@ void render_aabbs(Game& game, GLuint shader)
                 //glBindVertexArray(bbox_glo.vao);
                 glBindBuffer(GL_ARRAY_BUFFER, glo.vbo);
                 glBufferSubData(GL_ARRAY_BUFFER, 0, vertices.size() * sizeof(Vertex), vertices.data());
-                draw_object(shader, *game.white_texture, glo, obj->transform.matrix(), std::nullopt, std::nullopt);
+                draw_object(shader, *game.white_texture, glo, world.interpolated(*e, alpha).matrix(), std::nullopt, std::nullopt);
             }
         }
     }
     glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
 }
 
-/// Render Game scene
-void game_render(Game& game)
+/// Render Game scene, alpha is the fraction of a tick elapsed since the last game_update
+void game_render(Game& game, float alpha)
 {
+    ScopeTimer timer("game_render");
     begin_render(game);
-    GLuint shader = game.shader_program;
-    glUseProgram(shader);
-    set_camera(shader, *game.camera);
-
+    const ShaderProgram& shader = game.shader_program;
+    glUseProgram(shader.id);
+    set_camera(*game.camera_ubo, *game.camera);
+
+    // Objects are pre-transformed into the batch, so the shader is left with identity model
+    glUniformMatrix4fv(shader.model, 1, GL_FALSE, glm::value_ptr(glm::mat4(1.0f)));
+    glUniform2fv(shader.texoffset, 1, glm::value_ptr(glm::vec2(0.0f)));
+    SpriteBatch& batch = *game.sprite_batch;
+    batch.num_draws = 0;
+    World& world = game.scene->world;
     for (auto* object_list : game.scene->objects.all_lists()) {
-        for (auto obj = object_list->begin(); obj != object_list->end() && obj->glo && obj->texture; obj++) {
-            auto sprite = obj->sprite_animation ? std::make_optional<SpriteFrame>(obj->sprite_animation->curr_frame()) : std::nullopt;
-            draw_object(shader, *obj->texture, *obj->glo, obj->transform.matrix(), obj->texture_offset, sprite);
+        for (Entity e : *object_list) {
+            Mesh* mesh = world.meshes.get(e);
+            if (!mesh) continue;
+            if (world.static_chunks.has(e)) {
+                // chunk meshes are already in world-space and live in GPU memory
+                batch.flush();
+                draw_object(shader, *mesh->texture, *mesh->glo, glm::mat4(1.0f), std::nullopt, std::nullopt);
+                continue;
+            }
+            SpriteAnimation* sprite_animation = world.sprite_animations.get(e);
+            auto sprite = sprite_animation ? std::make_optional<SpriteFrame>(sprite_animation->curr_frame()) : std::nullopt;
+            TextureOffset* texture_offset = world.texture_offsets.get(e);
+            glm::vec2 texoffset = texture_offset ? texture_offset->vec : glm::vec2(0.f);
+            batch.push(*mesh->texture, *mesh->glo, world.interpolated(e, alpha).matrix(), texoffset, sprite);
         }
+        // layers are drawn in order
+        batch.flush();
     }
 
     if (game.debug_aabb)
-        render_aabbs(game, shader);
+        render_aabbs(game, shader, alpha);
 
     if (game.debug_grid)
         render_grid(game, shader);
 }
 
-/// Game Loop, only returns when game finishes
+/// Game Loop, only returns when game finishes.
+/// The simulation runs in fixed ticks, decoupled from the render frame rate.
 int game_loop(GLFWwindow* window)
 {
     Game game;
@@ -801,16 +1419,38 @@ int game_loop(GLFWwindow* window)
     if (ret) return ret;
     glfwSetWindowUserPointer(window, &game);
     float last_time = glfwGetTime();
+    float accumulator = 0.f;
     while (!glfwWindowShouldClose(window)) {
         float now_time = glfwGetTime();
-        float dt = now_time - last_time;
+        accumulator += std::min(now_time - last_time, kMaxFrameTime);
         last_time = now_time;
         glfwPollEvents();
-        game_update(game, dt);
-        game_render(game);
+        while (accumulator >= kTickDuration) {
+            game_update(game, kTickDuration);
+            accumulator -= kTickDuration;
+        }
+        game_render(game, accumulator / kTickDuration);
+        ScopeTimer timer("glfwSwapBuffers");
         glfwSwapBuffers(window);
     }
     glfwSetWindowUserPointer(window, NULL);
+    Profiler::instance().dump(kProfileTracePath);
+    return 0;
+}
+
+/// Headless Loop, runs the simulation for a number of ticks as fast as possible, without rendering
+int headless_loop(size_t num_ticks)
+{
+    Game game;
+    int ret = game_init(game, nullptr);
+    if (ret) return ret;
+    auto start_time = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < num_ticks; i++) {
+        game_update(game, kTickDuration);
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start_time;
+    printf("Headless: %zu ticks in %.3f s, %.0f ticks/s\n", num_ticks, elapsed.count(), num_ticks / elapsed.count());
+    Profiler::instance().dump(kProfileTracePath);
     return 0;
 }
 
@@ -821,13 +1461,15 @@ void key_left_right_handler(struct Game& game, int key, int action, int mods)
 {
     assert(key == GLFW_KEY_LEFT || key == GLFW_KEY_RIGHT);
     const float direction = (key == GLFW_KEY_LEFT ? -1.f : +1.f);
+    World& world = game.scene->world;
+    const Entity player = game.scene->player();
 
     if (action == GLFW_PRESS || action == GLFW_REPEAT) {
-        game.scene->player().motion.velocity.x = 8.f * direction;
-        game.scene->player().transform.scale.x = 1.2f * direction;
-        if (game.scene->player().entity_state == EntityState::IDLE) {
-            game.scene->player().sprite_animation->freeze = false;
-            game.scene->player().entity_state = EntityState::WALKING;
+        world.motions[player].velocity.x = 8.f * direction;
+        world.transforms[player].scale.x = 1.2f * direction;
+        if (world.entity_states[player] == EntityState::IDLE) {
+            world.sprite_animations[player].freeze = false;
+            world.entity_states[player] = EntityState::WALKING;
         }
     }
     else if (action == GLFW_RELEASE) {
@@ -837,12 +1479,12 @@ void key_left_right_handler(struct Game& game, int key, int action, int mods)
             key_left_right_handler(game, other_key, GLFW_REPEAT, mods);
         } else {
             // both arrow keys release, cease movement
-            game.scene->player().motion.velocity.x = 0.0f;
-            game.scene->player().motion.acceleration.x = 0.0f;
-            if (game.scene->player().entity_state == EntityState::WALKING) {
-                game.scene->player().entity_state = EntityState::IDLE;
-                game.scene->player().sprite_animation->freeze = true;
-                game.scene->player().sprite_animation->curr_frame_idx = 0;
+            world.motions[player].velocity.x = 0.0f;
+            world.motions[player].acceleration.x = 0.0f;
+            if (world.entity_states[player] == EntityState::WALKING) {
+                world.entity_states[player] = EntityState::IDLE;
+                world.sprite_animations[player].freeze = true;
+                world.sprite_animations[player].curr_frame_idx = 0;
             }
         }
     }
@@ -850,18 +1492,21 @@ void key_left_right_handler(struct Game& game, int key, int action, int mods)
 
 void key_space_handler(struct Game& game, int key, int action, int mods)
 {
+    World& world = game.scene->world;
+    const Entity player = game.scene->player();
+
     if (action == GLFW_PRESS || action == GLFW_REPEAT) {
-        game.scene->player().motion.velocity.y = 10.f;
-        game.scene->player().entity_state = EntityState::JUMPING;
-        game.scene->player().sprite_animation->freeze = true;
-        game.scene->player().sprite_animation->curr_frame_idx = 2;
+        world.motions[player].velocity.y = 10.f;
+        world.entity_states[player] = EntityState::JUMPING;
+        world.sprite_animations[player].freeze = true;
+        world.sprite_animations[player].curr_frame_idx = 2;
     }
     else if (action == GLFW_RELEASE) {
-        game.scene->player().motion.velocity.y = 0.0f;
-        game.scene->player().sprite_animation->freeze = true;
-        game.scene->player().sprite_animation->curr_frame_idx = 0;
-        if (game.scene->player().entity_state == EntityState::JUMPING)
-            game.scene->player().entity_state = EntityState::IDLE;
+        world.motions[player].velocity.y = 0.0f;
+        world.sprite_animations[player].freeze = true;
+        world.sprite_animations[player].curr_frame_idx = 0;
+        if (world.entity_states[player] == EntityState::JUMPING)
+            world.entity_states[player] = EntityState::IDLE;
     }
 }
 
@@ -877,6 +1522,12 @@ void key_f7_handler(struct Game& game, int key, int action, int mods)
     game.debug_aabb = !game.debug_aabb;
 }
 
+void key_f8_handler(struct Game& game, int key, int action, int mods)
+{
+  if (action == GLFW_PRESS)
+    Profiler::instance().dump(kProfileTracePath);
+}
+
 /// Handle Key input event
 void key_event_callback(GLFWwindow* window, int key, int scancode, int action, int mods)
 {
@@ -898,6 +1549,9 @@ void key_event_callback(GLFWwindow* window, int key, int scancode, int action, i
     else if (key == GLFW_KEY_F7) {
         key_f7_handler(*game, key, action, mods);
     }
+    else if (key == GLFW_KEY_F8) {
+        key_f8_handler(*game, key, action, mods);
+    }
 
     game->key_states.value()[key] = (action == GLFW_PRESS);
 }
@@ -923,8 +1577,7 @@ void framebuffer_size_callback(GLFWwindow* window, int width, int height)
     glViewport(0, 0, width, height);
     game->camera = Camera::create((float)width / (float)height);
 
-    auto [quad_vertices, quad_indices] = gen_quad_geometry(glm::vec2(1.f), glm::vec2(0.f), glm::vec2((float)width / (float)height, 1.0f));
-    game->canvas_quad_glo = std::make_shared<GLObject>(create_gl_object(quad_vertices.data(), quad_vertices.size(), quad_indices.data(), quad_indices.size()));
+    game->canvas_quad_glo = game->geometry_cache->quad(glm::vec2(1.f), glm::vec2(0.f), glm::vec2((float)width / (float)height, 1.0f));
 
     game->window.size.y = height;
     game->window.size.x = width;
@@ -975,10 +1628,18 @@ int load_opengl()
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 /// Main
 
-int main()
+int main(int argc, char* argv[])
 {
     int ret;
 
+    // Headless ===============================================================
+    // usage: --headless [num_ticks]
+    if (argc >= 2 && argv[1] == "--headless"s) {
+        g_headless = true;
+        size_t num_ticks = (argc >= 3) ? std::strtoul(argv[2], nullptr, 10) : 10000;
+        return headless_loop(num_ticks);
+    }
+
     // Create Window ==========================================================
     GLFWwindow* window;
     ret = create_window(window);